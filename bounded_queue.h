@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// Fixed-capacity multi-producer/multi-consumer queue. push() blocks while the queue is full, pop() blocks while it is
+// empty. Once close() has been called, push() fails and pop() drains the remaining items before returning nullopt.
+template <typename T>
+class bounded_queue {
+   public:
+    explicit bounded_queue(std::size_t capacity) : capacity_{capacity ? capacity : 1} {}
+
+    bool push(T value) {
+        std::unique_lock lock{mutex_};
+        not_full_.wait(lock, [&] { return closed_ || items_.size() < capacity_; });
+        if (closed_) return false;
+        items_.push_back(std::move(value));
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop() {
+        std::unique_lock lock{mutex_};
+        not_empty_.wait(lock, [&] { return closed_ || !items_.empty(); });
+        if (items_.empty()) return std::nullopt;
+        auto value = std::move(items_.front());
+        items_.pop_front();
+        lock.unlock();
+        not_full_.notify_one();
+        return value;
+    }
+
+    // Non-blocking pop; returns nullopt if nothing is queued right now
+    std::optional<T> try_pop() {
+        std::unique_lock lock{mutex_};
+        if (items_.empty()) return std::nullopt;
+        auto value = std::move(items_.front());
+        items_.pop_front();
+        lock.unlock();
+        not_full_.notify_one();
+        return value;
+    }
+
+    void close() {
+        {
+            std::lock_guard lock{mutex_};
+            closed_ = true;
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+   private:
+    std::size_t const capacity_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> items_;
+    bool closed_ = false;
+};
@@ -0,0 +1,370 @@
+#include "catalog.h"
+
+#include <sqlite3.h>
+
+#include <cctype>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+#include "log.h"
+
+namespace {
+
+struct close_database_t {
+    void operator()(sqlite3* db) const { ::sqlite3_close(db); }
+};
+
+struct finalize_statement_t {
+    void operator()(sqlite3_stmt* statement) const { ::sqlite3_finalize(statement); }
+};
+
+using database_t = std::unique_ptr<sqlite3, close_database_t>;
+using statement_t = std::unique_ptr<sqlite3_stmt, finalize_statement_t>;
+
+database_t open_database(boost::filesystem::path const& path) {
+    sqlite3* db = nullptr;
+    auto status = ::sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr);
+    database_t result{db};
+    if (status != SQLITE_OK) {
+        throw std::runtime_error("couldn't open " + path.string() + ": " +
+                                 (db ? ::sqlite3_errmsg(db) : ::sqlite3_errstr(status)));
+    }
+    return result;
+}
+
+statement_t prepare(sqlite3* db, char const* sql) {
+    sqlite3_stmt* statement = nullptr;
+    if (::sqlite3_prepare_v2(db, sql, -1, &statement, nullptr) != SQLITE_OK)
+        throw std::runtime_error(std::string{"couldn't query the catalog: "} + ::sqlite3_errmsg(db));
+    return statement_t{statement};
+}
+
+// Steps to the next row; false when done. Lightroom keeps its catalog locked while running, which shows up here.
+bool step(sqlite3* db, sqlite3_stmt* statement) {
+    switch (::sqlite3_step(statement)) {
+        case SQLITE_ROW:
+            return true;
+        case SQLITE_DONE:
+            return false;
+        case SQLITE_BUSY:
+            throw std::runtime_error("the catalog is locked; is Lightroom still running?");
+        default:
+            throw std::runtime_error(std::string{"couldn't read the catalog: "} + ::sqlite3_errmsg(db));
+    }
+}
+
+std::optional<std::string> column_text(sqlite3_stmt* statement, int column) {
+    auto text = ::sqlite3_column_text(statement, column);
+    if (!text) return std::nullopt;
+    return std::string{reinterpret_cast<char const*>(text),
+                       static_cast<std::size_t>(::sqlite3_column_bytes(statement, column))};
+}
+
+value_t text_value(std::string text) {
+    value_t v;
+    v.items.push_back(std::move(text));
+    return v;
+}
+
+value_t items_value(value_t::kind_t kind, std::vector<std::string> items) {
+    value_t v;
+    v.kind = kind;
+    v.items = std::move(items);
+    return v;
+}
+
+// Catalog orientations name the corners of the stored image (A top left, B top right, C bottom right, D bottom left)
+// that end up at the top left and top right of the displayed one
+std::optional<std::string> tiff_orientation(std::string const& orientation) {
+    static std::map<std::string, std::string> const orientations{
+        {"AB", "1"}, {"BA", "2"}, {"CD", "3"}, {"DC", "4"}, {"AD", "5"}, {"DA", "6"}, {"CB", "7"}, {"BC", "8"},
+    };
+    auto i = orientations.find(orientation);
+    if (i == orientations.end()) return std::nullopt;
+    return i->second;
+}
+
+// Reader for the Lua table constructor Lightroom stores develop settings as, e.g.
+//   s = { Exposure2012 = 0.35, HasCrop = true, ToneCurvePV2012 = { 0, 0, 255, 255, }, Look = { Name = "..." }, }
+// Each top-level field becomes Xmp.crs.<name> with the value XMP would carry: numbers and strings as text, booleans
+// as "True"/"False", arrays of scalars as lists, and any other table as an empty text, like an XMP struct.
+class develop_settings_reader_t {
+   public:
+    explicit develop_settings_reader_t(std::string_view text) : text_{text} {}
+
+    void read(std::map<std::string, value_t>& values) {
+        skip_space();
+        if (peek_identifier()) {
+            identifier();
+            expect('=');
+        }
+        expect('{');
+        while (!accept('}')) {
+            auto name = identifier();
+            expect('=');
+            auto value = field_value();
+            if (value) values.insert_or_assign("Xmp.crs." + name, std::move(*value));
+            if (!accept(',')) accept(';');
+        }
+    }
+
+   private:
+    [[noreturn]] void fail() const {
+        throw std::runtime_error("malformed develop settings at offset " + std::to_string(position_));
+    }
+
+    void skip_space() {
+        while (position_ < text_.size()) {
+            if (std::isspace(static_cast<unsigned char>(text_[position_]))) {
+                ++position_;
+            } else if (text_.compare(position_, 2, "--") == 0) {
+                position_ = std::min(text_.size(), text_.find('\n', position_));
+            } else {
+                break;
+            }
+        }
+    }
+
+    bool accept(char c) {
+        skip_space();
+        if (position_ >= text_.size() || text_[position_] != c) return false;
+        ++position_;
+        return true;
+    }
+
+    void expect(char c) {
+        if (!accept(c)) fail();
+    }
+
+    bool peek_identifier() {
+        skip_space();
+        return position_ < text_.size() &&
+               (std::isalpha(static_cast<unsigned char>(text_[position_])) || text_[position_] == '_');
+    }
+
+    std::string identifier() {
+        if (!peek_identifier()) fail();
+        auto start = position_;
+        while (position_ < text_.size() &&
+               (std::isalnum(static_cast<unsigned char>(text_[position_])) || text_[position_] == '_'))
+            ++position_;
+        return std::string{text_.substr(start, position_ - start)};
+    }
+
+    // A top-level field; nullopt for nil
+    std::optional<value_t> field_value() {
+        skip_space();
+        if (position_ < text_.size() && text_[position_] == '{') {
+            std::vector<std::string> items;
+            bool is_array = table(items);
+            return is_array ? items_value(value_t::kind_t::list, std::move(items)) : text_value({});
+        }
+        auto value = scalar();
+        if (!value) return std::nullopt;
+        return text_value(std::move(*value));
+    }
+
+    // Reads a table, collecting its elements if they are all positional scalars; returns whether they were
+    bool table(std::vector<std::string>& items) {
+        expect('{');
+        bool is_array = true;
+        while (!accept('}')) {
+            skip_space();
+            if (position_ >= text_.size()) fail();
+            if (text_[position_] == '[') {
+                ++position_;
+                skip_space();
+                scalar();
+                expect(']');
+                expect('=');
+                is_array = false;
+            } else if (peek_identifier()) {
+                auto start = position_;
+                auto name = identifier();
+                if (accept('=')) {
+                    is_array = false;
+                } else if (name == "true" || name == "false" || name == "nil") {
+                    position_ = start;
+                } else {
+                    fail();
+                }
+            }
+            skip_space();
+            if (position_ < text_.size() && text_[position_] == '{') {
+                std::vector<std::string> ignored;
+                table(ignored);
+                is_array = false;
+            } else {
+                auto value = scalar();
+                if (value && is_array) items.push_back(std::move(*value));
+            }
+            if (!accept(',')) accept(';');
+        }
+        return is_array;
+    }
+
+    // A string, number or boolean as XMP would spell it; nullopt for nil
+    std::optional<std::string> scalar() {
+        skip_space();
+        if (position_ >= text_.size()) fail();
+        auto c = text_[position_];
+        if (c == '"' || c == '\'') return quoted_string();
+        if (peek_identifier()) {
+            auto name = identifier();
+            if (name == "true") return std::string{"True"};
+            if (name == "false") return std::string{"False"};
+            if (name == "nil") return std::nullopt;
+            fail();
+        }
+        auto start = position_;
+        while (position_ < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[position_])) ||
+                                            std::string_view{"+-."}.find(text_[position_]) != std::string_view::npos))
+            ++position_;
+        if (start == position_) fail();
+        return std::string{text_.substr(start, position_ - start)};
+    }
+
+    std::string quoted_string() {
+        auto quote = text_[position_++];
+        std::string result;
+        while (true) {
+            if (position_ >= text_.size()) fail();
+            auto c = text_[position_++];
+            if (c == quote) return result;
+            if (c != '\\') {
+                result += c;
+                continue;
+            }
+            if (position_ >= text_.size()) fail();
+            c = text_[position_++];
+            switch (c) {
+                case 'n':
+                    result += '\n';
+                    break;
+                case 'r':
+                    result += '\r';
+                    break;
+                case 't':
+                    result += '\t';
+                    break;
+                case '\n':
+                    result += '\n';
+                    break;
+                default:
+                    if (std::isdigit(static_cast<unsigned char>(c))) {
+                        int code = c - '0';
+                        for (int n = 0; n < 2 && position_ < text_.size() &&
+                                        std::isdigit(static_cast<unsigned char>(text_[position_]));
+                             ++n)
+                            code = code * 10 + (text_[position_++] - '0');
+                        result += static_cast<char>(code);
+                    } else {
+                        result += c;
+                    }
+            }
+        }
+    }
+
+    std::string_view text_;
+    std::size_t position_ = 0;
+};
+
+struct keywords_t {
+    std::vector<std::string> flat;
+    std::vector<std::string> hierarchical;
+};
+
+// Keywords assigned to each image, by image id. Lightroom's keyword tree has a nameless root.
+std::unordered_map<sqlite3_int64, keywords_t> read_keywords(sqlite3* db) {
+    struct keyword_t {
+        std::string name;
+        sqlite3_int64 parent = 0;
+    };
+    std::unordered_map<sqlite3_int64, keyword_t> keywords;
+    auto statement = prepare(db, "SELECT id_local, name, parent FROM AgLibraryKeyword WHERE name IS NOT NULL");
+    while (step(db, statement.get())) {
+        keywords[::sqlite3_column_int64(statement.get(), 0)] =
+            keyword_t{column_text(statement.get(), 1).value_or(""), ::sqlite3_column_int64(statement.get(), 2)};
+    }
+
+    std::unordered_map<sqlite3_int64, keywords_t> result;
+    statement = prepare(db, "SELECT image, tag FROM AgLibraryKeywordImage ORDER BY image");
+    while (step(db, statement.get())) {
+        auto keyword = keywords.find(::sqlite3_column_int64(statement.get(), 1));
+        if (keyword == keywords.end()) continue;
+        auto&& image = result[::sqlite3_column_int64(statement.get(), 0)];
+        image.flat.push_back(keyword->second.name);
+        auto path = keyword->second.name;
+        for (auto parent = keywords.find(keyword->second.parent); parent != keywords.end();
+             parent = keywords.find(parent->second.parent))
+            path = parent->second.name + "|" + path;
+        image.hierarchical.push_back(std::move(path));
+    }
+    return result;
+}
+
+char const* const images_query = R"(
+SELECT root.absolutePath || folder.pathFromRoot || file.baseName || '.' || file.extension,
+       image.id_local, image.fileWidth, image.fileHeight, image.orientation, image.rating, image.colorLabels,
+       develop.text, iptc.caption, iptc.copyright, creator.value
+FROM Adobe_images image
+JOIN AgLibraryFile file ON file.id_local = image.rootFile
+JOIN AgLibraryFolder folder ON folder.id_local = file.folder
+JOIN AgLibraryRootFolder root ON root.id_local = folder.rootFolder
+LEFT JOIN Adobe_imageDevelopSettings develop ON develop.image = image.id_local
+LEFT JOIN AgLibraryIPTC iptc ON iptc.image = image.id_local
+LEFT JOIN AgHarvestedIptcMetadata harvested ON harvested.image = image.id_local
+LEFT JOIN AgInternedIptcCreator creator ON creator.id_local = harvested.creatorRef
+WHERE image.masterImage IS NULL
+ORDER BY image.id_local
+)";
+
+}  // namespace
+
+void read_catalog(boost::filesystem::path const& catalog_path, std::function<void(catalog_image_t)> const& f) {
+    auto db = open_database(catalog_path);
+    auto keywords = read_keywords(db.get());
+    auto statement = prepare(db.get(), images_query);
+    while (step(db.get(), statement.get())) {
+        auto row = statement.get();
+        catalog_image_t image;
+        // Symlinks and ./.. in the root folder would otherwise shard and match differently than a directory walk
+        boost::system::error_code ec;
+        image.path = column_text(row, 0).value_or("");
+        auto canonical = boost::filesystem::weakly_canonical(image.path, ec);
+        if (!ec) image.path = std::move(canonical);
+        image.record.width = ::sqlite3_column_int64(row, 2);
+        image.record.height = ::sqlite3_column_int64(row, 3);
+        auto&& values = image.record.sidecar;
+        if (auto orientation = column_text(row, 4)) {
+            if (auto tiff = tiff_orientation(*orientation)) values["Xmp.tiff.Orientation"] = text_value(*tiff);
+        }
+        if (::sqlite3_column_type(row, 5) != SQLITE_NULL)
+            values["Xmp.xmp.Rating"] = text_value(std::to_string(::sqlite3_column_int(row, 5)));
+        if (auto label = column_text(row, 6); label && !label->empty()) values["Xmp.xmp.Label"] = text_value(*label);
+        if (auto text = column_text(row, 7)) {
+            try {
+                develop_settings_reader_t{*text}.read(values);
+            } catch (std::runtime_error const& e) {
+                log_message(log_level_t::warning, "Couldn't read develop settings of ", image.path,
+                            " from the catalog: ", e.what());
+                continue;
+            }
+        }
+        if (auto caption = column_text(row, 8); caption && !caption->empty())
+            values["Xmp.dc.description"] = items_value(value_t::kind_t::lang_alt, {*caption});
+        if (auto copyright = column_text(row, 9); copyright && !copyright->empty())
+            values["Xmp.dc.rights"] = items_value(value_t::kind_t::lang_alt, {*copyright});
+        if (auto creator = column_text(row, 10); creator && !creator->empty())
+            values["Xmp.dc.creator"] = items_value(value_t::kind_t::list, {*creator});
+        auto k = keywords.find(::sqlite3_column_int64(row, 1));
+        if (k != keywords.end()) {
+            values["Xmp.dc.subject"] = items_value(value_t::kind_t::list, std::move(k->second.flat));
+            values["Xmp.lr.hierarchicalSubject"] =
+                items_value(value_t::kind_t::list, std::move(k->second.hierarchical));
+        }
+        f(std::move(image));
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <functional>
+
+#include "metadata.h"
+
+// An image in a Lightroom catalog, with the metadata Lightroom would write to its XMP sidecar
+struct catalog_image_t {
+    // Canonical as far as the file exists, like the paths of walked images
+    boost::filesystem::path path;
+    metadata_record_t record;
+};
+
+// Reads every image of a Lightroom catalog (.lrcat) in one pass over its tables, calling f for each in catalog order.
+// Develop settings and library metadata land in record.sidecar under the keys Lightroom uses in XMP, so the importers
+// read them exactly as they would read a sidecar; record.width and height are the dimensions Lightroom recorded.
+// Virtual copies are left out, since RawTherapee has a single profile per file. Throws std::runtime_error if the
+// catalog can't be opened or doesn't have the expected tables.
+void read_catalog(boost::filesystem::path const& catalog_path, std::function<void(catalog_image_t)> const& f);
@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "exiv2.h"
+#include "value.h"
 
 namespace detail {
 
@@ -30,22 +31,35 @@ struct get_value_impl<bool> {
 
             case Exiv2::TypeId::asciiString:
             case Exiv2::TypeId::string:
-            case Exiv2::TypeId::xmpText: {
-                auto s = x.toString();
-                if (boost::iequals(s, "true")) return true;
-                if (boost::iequals(s, "yes")) return true;
-                if (boost::iequals(s, "on")) return true;
-                if (boost::iequals(s, "1")) return true;
-                if (boost::iequals(s, "false")) return false;
-                if (boost::iequals(s, "no")) return false;
-                if (boost::iequals(s, "off")) return false;
-                if (boost::iequals(s, "0")) return false;
-                return std::nullopt;
-            }
+            case Exiv2::TypeId::xmpText:
+                return parse(x.toString());
+            default:
+                throw std::logic_error("not implemented");
+        }
+    }
+
+    static std::optional<bool> impl(value_t const& x) {
+        switch (x.kind) {
+            case value_t::kind_t::integer:
+                return x.number != 0;
+            case value_t::kind_t::text:
+                return parse(x.items.front());
             default:
                 throw std::logic_error("not implemented");
         }
     }
+
+    static std::optional<bool> parse(std::string const& s) {
+        if (boost::iequals(s, "true")) return true;
+        if (boost::iequals(s, "yes")) return true;
+        if (boost::iequals(s, "on")) return true;
+        if (boost::iequals(s, "1")) return true;
+        if (boost::iequals(s, "false")) return false;
+        if (boost::iequals(s, "no")) return false;
+        if (boost::iequals(s, "off")) return false;
+        if (boost::iequals(s, "0")) return false;
+        return std::nullopt;
+    }
 };
 
 template <typename T>
@@ -72,16 +86,32 @@ struct get_value_impl<T, std::enable_if_t<std::is_arithmetic_v<T>>> {
 
             case Exiv2::TypeId::asciiString:
             case Exiv2::TypeId::string:
-            case Exiv2::TypeId::xmpText: {
-                std::istringstream i{x.toString()};
-                T value;
-                i >> value;
-                return value;
-            }
+            case Exiv2::TypeId::xmpText:
+                return parse(x.toString());
+            default:
+                throw std::logic_error("not implemented");
+        }
+    }
+
+    static std::optional<T> impl(value_t const& x) {
+        switch (x.kind) {
+            case value_t::kind_t::integer:
+                return static_cast<long>(x.number);
+            case value_t::kind_t::real:
+                return static_cast<float>(x.number);
+            case value_t::kind_t::text:
+                return parse(x.items.front());
             default:
                 throw std::logic_error("not implemented");
         }
     }
+
+    static std::optional<T> parse(std::string const& s) {
+        std::istringstream i{s};
+        T value;
+        i >> value;
+        return value;
+    }
 };
 
 template <>
@@ -110,6 +140,18 @@ struct get_value_impl<std::string> {
                 throw std::logic_error("not implemented");
         }
     }
+
+    static std::optional<std::string> impl(value_t const& x) {
+        switch (x.kind) {
+            case value_t::kind_t::text:
+            case value_t::kind_t::lang_alt:
+                return x.items.front();
+            case value_t::kind_t::list:
+                return boost::join(x.items, "\n");
+            default:
+                throw std::logic_error("not implemented");
+        }
+    }
 };
 
 template <>
@@ -134,6 +176,18 @@ struct get_value_impl<std::vector<std::string>> {
                 throw std::logic_error("not implemented");
         }
     }
+
+    static std::optional<std::vector<std::string>> impl(value_t const& x) {
+        switch (x.kind) {
+            case value_t::kind_t::text:
+            case value_t::kind_t::lang_alt:
+            case value_t::kind_t::alt:
+            case value_t::kind_t::list:
+                return x.items;
+            default:
+                throw std::logic_error("not implemented");
+        }
+    }
 };
 
 }  // namespace detail
@@ -142,3 +196,8 @@ template <typename T>
 std::optional<T> get_value(Exiv2::Value const& x) {
     return detail::get_value_impl<T>::impl(x);
 }
+
+template <typename T>
+std::optional<T> get_value(value_t const& x) {
+    return detail::get_value_impl<T>::impl(x);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <CImg.h>
+#include <stdexcept>
+
+struct histograms {
+    cimg_library::CImg<float> r;
+    cimg_library::CImg<float> g;
+    cimg_library::CImg<float> b;
+    cimg_library::CImg<float> s;
+    cimg_library::CImg<float> i;
+
+    template <typename T>
+    histograms(cimg_library::CImg<T> const& rgb, int level_count, float blur_sigma) {
+        if (rgb.spectrum() != 3) throw std::runtime_error("Image is not RGB");
+        auto hsi = rgb.get_RGBtoHSI();
+        r = rgb.get_shared_channel(0).get_histogram(level_count);
+        r.blur(blur_sigma, false, true);
+        g = rgb.get_shared_channel(1).get_histogram(level_count);
+        g.blur(blur_sigma, false, true);
+        b = rgb.get_shared_channel(2).get_histogram(level_count);
+        b.blur(blur_sigma, false, true);
+        s = hsi.get_shared_channel(1).get_histogram(level_count);
+        s.blur(blur_sigma, false, true);
+        i = hsi.get_shared_channel(2).get_histogram(level_count);
+        i.blur(blur_sigma, false, true);
+    };
+
+    template <typename T>
+    explicit histograms(cimg_library::CImg<T> const& rgb) : histograms(rgb, 256, 16) {}
+
+    [[nodiscard]] double error(histograms const& other, double wr, double wg, double wb, double ws, double wi) const {
+        return wr * r.MSE(other.r) + wg * g.MSE(other.g) + wb * b.MSE(other.b) + ws * s.MSE(other.s) +
+               wi * i.MSE(other.i);
+    }
+
+    [[nodiscard]] double error(histograms const& other) const { return error(other, 1, 1, 1, 2, 2); }
+};
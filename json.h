@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+// Minimal JSON string escaping for the hand-written JSON reports.
+inline std::string json_string(std::string const& x) {
+    std::string result = "\"";
+    for (char c : x) {
+        switch (c) {
+            case '"':
+                result += "\\\"";
+                break;
+            case '\\':
+                result += "\\\\";
+                break;
+            case '\n':
+                result += "\\n";
+                break;
+            case '\r':
+                result += "\\r";
+                break;
+            case '\t':
+                result += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    result += buffer;
+                } else {
+                    result += c;
+                }
+        }
+    }
+    result += '"';
+    return result;
+}
+
+// A number as an ostream would write it, or null for NaN and infinities, which JSON has no literal for
+inline std::string json_number(double x) {
+    if (!std::isfinite(x)) return "null";
+    std::ostringstream o;
+    o << x;
+    return o.str();
+}
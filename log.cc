@@ -0,0 +1,226 @@
+#include "log.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "json.h"
+#include "ring_buffer.h"
+
+log_level_t parse_log_level(std::string const& x) {
+    if (x == "debug") return log_level_t::debug;
+    if (x == "info") return log_level_t::info;
+    if (x == "warning") return log_level_t::warning;
+    if (x == "error") return log_level_t::error;
+    if (x == "quiet") return log_level_t::quiet;
+    throw std::invalid_argument{"expected a log level of debug, info, warning, error or quiet, not \"" + x + "\""};
+}
+
+log_format_t parse_log_format(std::string const& x) {
+    if (x == "text") return log_format_t::text;
+    if (x == "json") return log_format_t::json;
+    throw std::invalid_argument{"expected a log format of text or json, not \"" + x + "\""};
+}
+
+namespace {
+
+struct log_record_t {
+    log_level_t level = log_level_t::info;
+    std::chrono::system_clock::time_point time;
+    std::string path;  // empty for messages
+    char const* stage = nullptr;
+    char const* outcome = nullptr;
+    std::chrono::nanoseconds duration{0};
+    std::string text;  // the message, or a file record's detail
+};
+
+char const* level_name(log_level_t level) {
+    switch (level) {
+        case log_level_t::debug:
+            return "debug";
+        case log_level_t::info:
+            return "info";
+        case log_level_t::warning:
+            return "warning";
+        case log_level_t::error:
+        case log_level_t::quiet:
+            break;
+    }
+    return "error";
+}
+
+void append_number(std::string& out, char const* format, double x) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), format, x);
+    out += buffer;
+}
+
+void format_text(log_record_t const& x, std::string& out) {
+    if (x.level >= log_level_t::warning) out.append(level_name(x.level)).append(": ");
+    if (x.path.empty()) {
+        out += x.text;
+    } else {
+        out.append(x.path).append(": ").append(x.outcome).append(" (").append(x.stage).append(", ");
+        append_number(out, "%.3f", std::chrono::duration<double, std::milli>(x.duration).count());
+        out += " ms)";
+        if (!x.text.empty()) out.append(": ").append(x.text);
+    }
+    out += '\n';
+}
+
+void format_json(log_record_t const& x, std::string& out) {
+    out += "{\"time\": ";
+    append_number(out, "%.3f", std::chrono::duration<double>(x.time.time_since_epoch()).count());
+    out.append(", \"level\": \"").append(level_name(x.level)).append("\"");
+    if (x.path.empty()) {
+        out.append(", \"message\": ").append(json_string(x.text));
+    } else {
+        out.append(", \"path\": ").append(json_string(x.path));
+        out.append(", \"stage\": \"").append(x.stage).append("\", \"outcome\": \"").append(x.outcome).append("\"");
+        out += ", \"duration_ms\": ";
+        append_number(out, "%.3f", std::chrono::duration<double, std::milli>(x.duration).count());
+        if (!x.text.empty()) out.append(", \"detail\": ").append(json_string(x.text));
+    }
+    out += "}\n";
+}
+
+void write_out(std::string& buffer) {
+    for (std::size_t written = 0; written < buffer.size();) {
+        auto n = ::write(STDERR_FILENO, buffer.data() + written, buffer.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += n;
+    }
+    buffer.clear();
+}
+
+// Producers only ever touch the ring buffer, unless the writer has gone idle and needs waking. The writer formats
+// whatever has been queued in one go, then sleeps until woken, so an idle process has an idle writer.
+class logger_t {
+   public:
+    logger_t() : writer_{[this] { drain(); }} {}
+
+    ~logger_t() {
+        stopping_.store(true, std::memory_order_release);
+        wake();
+        writer_.join();
+    }
+
+    void configure(log_options_t const& options) {
+        level_.store(options.level, std::memory_order_relaxed);
+        json_.store(options.format == log_format_t::json, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool enabled(log_level_t level) const { return level >= level_.load(std::memory_order_relaxed); }
+
+    void push(log_record_t record) {
+        while (!records_.try_push(record)) {
+            wake();
+            std::this_thread::yield();
+        }
+        // Pairs with the fence in drain(): either the writer sees this record before sleeping, or this sees it idle
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle_.load(std::memory_order_relaxed)) wake();
+    }
+
+    void flush() {
+        auto target = records_.pushed();
+        wake();
+        std::unique_lock lock{mutex_};
+        flushed_.wait(lock, [&] { return written_ >= target; });
+    }
+
+   private:
+    void wake() {
+        {
+            std::lock_guard lock{mutex_};
+            woken_ = true;
+        }
+        wake_.notify_one();
+    }
+
+    void drain() {
+        std::string buffer;
+        log_record_t record;
+        while (true) {
+            auto stopping = stopping_.load(std::memory_order_acquire);
+            auto json = json_.load(std::memory_order_relaxed);
+            std::size_t count = 0;
+            while (records_.try_pop(record)) {
+                json ? format_json(record, buffer) : format_text(record, buffer);
+                ++count;
+                if (buffer.size() >= 64 * 1024) write_out(buffer);
+            }
+            write_out(buffer);
+            std::unique_lock lock{mutex_};
+            written_ += count;
+            flushed_.notify_all();
+            if (stopping) return;
+            if (count) continue;
+            idle_.store(true, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // A record pushed before the producer could see idle_ set won't come with a wake-up
+            if (!records_.ready()) wake_.wait(lock, [&] { return woken_; });
+            woken_ = false;
+            idle_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<log_level_t> level_{log_level_t::info};
+    std::atomic<bool> json_{false};
+    ring_buffer<log_record_t> records_{4096};
+    std::atomic<bool> idle_{false};
+    std::atomic<bool> stopping_{false};
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_;
+    bool woken_ = false;
+    std::size_t written_ = 0;
+    std::thread writer_;
+};
+
+logger_t& logger() {
+    static logger_t instance;
+    return instance;
+}
+
+}  // namespace
+
+void configure_log(log_options_t const& options) { logger().configure(options); }
+
+bool log_enabled(log_level_t level) { return logger().enabled(level); }
+
+void log_string(log_level_t level, std::string message) {
+    if (!log_enabled(level)) return;
+    log_record_t record;
+    record.level = level;
+    record.time = std::chrono::system_clock::now();
+    record.text = std::move(message);
+    logger().push(std::move(record));
+}
+
+void log_file(log_level_t level,
+              boost::filesystem::path const& path,
+              char const* stage,
+              char const* outcome,
+              std::chrono::nanoseconds duration,
+              std::string detail) {
+    if (!log_enabled(level)) return;
+    log_record_t record;
+    record.level = level;
+    record.time = std::chrono::system_clock::now();
+    record.path = path.string();
+    record.stage = stage;
+    record.outcome = outcome;
+    record.duration = duration;
+    record.text = std::move(detail);
+    logger().push(std::move(record));
+}
+
+void flush_log() { logger().flush(); }
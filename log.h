@@ -0,0 +1,53 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <sstream>
+#include <string>
+
+// Diagnostics of lr2rt. Records are queued on a lock-free ring buffer and formatted and written to stderr by a
+// background thread, so that workers neither wait for the terminal nor interleave their lines. Anything below the
+// configured level is dropped before it is formatted, or even queued.
+
+enum class log_level_t { debug, info, warning, error, quiet };
+enum class log_format_t { text, json };
+
+struct log_options_t {
+    log_level_t level = log_level_t::info;
+    log_format_t format = log_format_t::text;
+};
+
+// Parse "debug", "info", "warning", "error" or "quiet"; throw std::invalid_argument otherwise
+log_level_t parse_log_level(std::string const& x);
+// Parse "text" or "json"; throw std::invalid_argument otherwise
+log_format_t parse_log_format(std::string const& x);
+
+void configure_log(log_options_t const& options);
+
+[[nodiscard]] bool log_enabled(log_level_t level);
+
+// Queues a free-form message, already formatted
+void log_string(log_level_t level, std::string message);
+
+// Queues a message made of everything streamed from `parts`, if its level is enabled
+template <typename... T>
+void log_message(log_level_t level, T const&... parts) {
+    if (!log_enabled(level)) return;
+    std::ostringstream o;
+    (o << ... << parts);
+    log_string(level, o.str());
+}
+
+// Queues what a stage did with a file, and how long it took. In JSON:
+//   {"time": 1700000000.123, "level": "info", "path": "...", "stage": "write", "outcome": "written",
+//    "duration_ms": 0.4, "detail": "..."}
+// `stage` and `outcome` must be string literals.
+void log_file(log_level_t level,
+              boost::filesystem::path const& path,
+              char const* stage,
+              char const* outcome,
+              std::chrono::nanoseconds duration,
+              std::string detail = {});
+
+// Waits until everything logged so far has been written
+void flush_log();
@@ -0,0 +1,139 @@
+#include "lr2rt.h"
+
+#include <algorithm>
+#include <boost/filesystem/fstream.hpp>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "bounded_queue.h"
+#include "import_crop.h"
+#include "import_development.h"
+#include "import_tags.h"
+#include "mmap_io.h"
+#include "xmp_sidecar.h"
+
+void import_all(metadata_t const& metadata, settings_t& settings) {
+    import_tags(metadata, settings);
+    import_development(metadata, settings);
+    import_crop(metadata, settings);
+}
+
+namespace {
+
+std::optional<std::string> read_file(boost::filesystem::path const& path) {
+    if (!boost::filesystem::is_regular_file(path)) return std::nullopt;
+    boost::filesystem::ifstream i{path, std::ios::binary};
+    return std::string{std::istreambuf_iterator<char>{i}, std::istreambuf_iterator<char>{}};
+}
+
+}  // namespace
+
+import_request_t import_request_from_files(boost::filesystem::path const& image_path) {
+    import_request_t request;
+    request.image = std::make_unique<mmap_io_t>(image_path);
+    request.sidecar = read_file(xmp_sidecar_path(image_path));
+    request.pp3 = read_file(pp3_path(image_path)).value_or("");
+    return request;
+}
+
+struct importer_t::impl_t {
+    explicit impl_t(importer_options_t const& options)
+        : options{options},
+          jobs{options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency())},
+          tasks{4 * jobs} {
+        initialize_xmp_toolkit();
+        for (unsigned n = 0; n < jobs; ++n) {
+            workers.emplace_back([this] {
+                while (auto task = tasks.pop()) (*task)();
+            });
+        }
+    }
+
+    ~impl_t() {
+        tasks.close();
+        for (auto&& worker : workers) worker.join();
+    }
+
+    import_result_t import(import_request_t request) const {
+        import_result_t result;
+        try {
+            std::unique_ptr<metadata_t> metadata;
+            if (request.image) {
+                auto sidecar = request.sidecar ? parse_xmp(*request.sidecar) : std::map<std::string, value_t>{};
+                metadata = std::make_unique<metadata_t>(Exiv2::BasicIo::AutoPtr{request.image.release()},
+                                                        std::move(sidecar));
+            } else {
+                metadata = std::make_unique<metadata_t>(
+                    record_from_blocks(request.exif, request.xmp, request.sidecar, request.width, request.height));
+                // Guessing the size would crop differently than importing the file does
+                if (metadata->get<bool>("Xmp.crs.HasCrop").value_or(false) && (!request.width || !request.height))
+                    throw std::invalid_argument{"a cropped image sent as metadata blocks needs its width and height"};
+            }
+            if (!metadata->is_lightroom() && !options.force) {
+                result.status = import_result_t::status_t::not_lightroom;
+                return result;
+            }
+            settings_t settings{options.base_profile};
+            std::istringstream i{request.pp3};
+            settings.read(i);
+            import_all(*metadata, settings);
+            if (settings.empty()) {
+                result.status = import_result_t::status_t::nothing_to_import;
+                return result;
+            }
+            std::ostringstream o;
+            settings.write(o);
+            result.pp3 = o.str();
+            result.status = import_result_t::status_t::imported;
+        } catch (std::exception const& e) {
+            result.status = import_result_t::status_t::failed;
+            result.error = e.what();
+        }
+        return result;
+    }
+
+    std::vector<import_result_t> import(std::vector<import_request_t> requests) {
+        std::vector<import_result_t> results(requests.size());
+        std::mutex mutex;
+        std::condition_variable done;
+        auto remaining = requests.size();
+        for (std::size_t n = 0; n < requests.size(); ++n) {
+            tasks.push([&, n] {
+                results[n] = import(std::move(requests[n]));
+                std::lock_guard lock{mutex};
+                if (--remaining == 0) done.notify_one();
+            });
+        }
+        std::unique_lock lock{mutex};
+        done.wait(lock, [&] { return remaining == 0; });
+        return results;
+    }
+
+    void submit(import_request_t request, std::function<void(import_result_t)> done) {
+        // std::function needs a copyable task, and requests own their image
+        auto shared = std::make_shared<import_request_t>(std::move(request));
+        tasks.push([this, shared, done = std::move(done)] { done(import(std::move(*shared))); });
+    }
+
+    importer_options_t const options;
+    unsigned const jobs;
+    bounded_queue<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+};
+
+importer_t::importer_t(importer_options_t const& options) : impl_{std::make_unique<impl_t>(options)} {}
+
+importer_t::~importer_t() = default;
+
+import_result_t importer_t::import(import_request_t request) const { return impl_->import(std::move(request)); }
+
+std::vector<import_result_t> importer_t::import(std::vector<import_request_t> requests) {
+    return impl_->import(std::move(requests));
+}
+
+void importer_t::submit(import_request_t request, std::function<void(import_result_t)> done) {
+    impl_->submit(std::move(request), std::move(done));
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "metadata.h"
+#include "settings.h"
+
+// Embedding interface to lr2rt: imports Lightroom settings for images held in memory and returns RawTherapee
+// profiles as text, without touching the filesystem. The lr2rt command line tool drives the same importers over
+// files through pipeline_t.
+
+// Applies every importer to the metadata
+void import_all(metadata_t const& metadata, settings_t& settings);
+
+// One image to import. Its own metadata comes from `image` if set, otherwise from the `exif` and `xmp` blocks (see
+// record_from_blocks); the sidecar packet and the image's current profile are passed as text.
+struct import_request_t {
+    std::unique_ptr<Exiv2::BasicIo> image;
+    std::string exif;
+    std::string xmp;
+    // With blocks, the sensor size Exiv2 reports for the whole image; a cropped image can't be imported without it
+    long width = 0;
+    long height = 0;
+    std::optional<std::string> sidecar;
+    std::string pp3;
+};
+
+// Request for an image on disk: the image, its XMP sidecar and its current profile, if they exist
+import_request_t import_request_from_files(boost::filesystem::path const& image_path);
+
+struct import_result_t {
+    enum class status_t {
+        imported,           // pp3 holds the updated profile
+        not_lightroom,      // the image wasn't edited in Lightroom (see importer_options_t::force)
+        nothing_to_import,  // no settings to write
+        failed,             // error says why
+    };
+
+    status_t status = status_t::failed;
+    std::string pp3;
+    std::string error;
+};
+
+struct importer_options_t {
+    bool force = false;
+    unsigned jobs = 0;
+    // Profile that every imported profile starts from, if any (see read_base_profile)
+    std::shared_ptr<profile_t const> base_profile;
+};
+
+// Imports requests one at a time or in batches. Construction does the one-time setup (the XMP toolkit, a pool of
+// `jobs` worker threads, or one per core), so a long-lived importer should serve many requests.
+class importer_t {
+   public:
+    explicit importer_t(importer_options_t const& options = {});
+    ~importer_t();
+    importer_t(importer_t const&) = delete;
+    importer_t& operator=(importer_t const&) = delete;
+
+    // Imports on the calling thread
+    [[nodiscard]] import_result_t import(import_request_t request) const;
+
+    // Imports the requests in parallel on the worker threads; results are in request order
+    [[nodiscard]] std::vector<import_result_t> import(std::vector<import_request_t> requests);
+
+    // Queues the request for the worker threads and returns; `done` is called on a worker with the result
+    void submit(import_request_t request, std::function<void(import_result_t)> done);
+
+   private:
+    struct impl_t;
+    std::unique_ptr<impl_t> impl_;
+};
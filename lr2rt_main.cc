@@ -1,28 +1,36 @@
-#include <boost/filesystem.hpp>
-#include <boost/filesystem/fstream.hpp>
 #include <boost/program_options.hpp>
 #include <iostream>
 
-#include "import_crop.h"
-#include "import_development.h"
-#include "import_tags.h"
-#include "metadata.h"
-#include "settings.h"
-
-struct options_t {
-    std::vector<std::string> inputs;
-    bool force = false;
-};
+#include "run.h"
 
 auto parse_options(int argc, char* const* argv) {
-    options_t options;
+    run_options_t options;
 
     boost::program_options::options_description o;
     // clang-format off
     o.add_options()
     ("help", "show this help message")
-    ("input,i", boost::program_options::value(&options.inputs)->required(), "input file or directory")
-    ("force,f", boost::program_options::bool_switch(&options.force), "force processing, even if the file isn't marked as a lightroom file")
+    ("input,i", boost::program_options::value(&options.inputs), "input file or directory")
+    ("files-from", boost::program_options::value(&options.files_from), "also read input paths from this file, one per line (- for stdin)")
+    ("extensions", boost::program_options::value<std::string>()->default_value(default_raw_extensions), "comma-separated extensions of the images to import from input directories (* for any file)")
+    ("null,0", boost::program_options::bool_switch(&options.null_separated), "paths in --files-from are NUL-terminated, as written by find -print0")
+    ("shard", boost::program_options::value<std::string>(), "only process shard i/N (0 <= i < N) of the input files, split by a hash of their canonical paths")
+    ("catalog", boost::program_options::value(&options.catalog), "import the images of this Lightroom catalog (.lrcat), or only those under the inputs if any are given")
+    ("base-profile", boost::program_options::value(&options.base_profile), "start every profile from this RawTherapee profile, e.g. a house default; the image's own profile and Lightroom settings override its values")
+    ("force,f", boost::program_options::bool_switch(&options.pipeline.force), "force processing, even if the file isn't marked as a lightroom file")
+    ("jobs,j", boost::program_options::value(&options.pipeline.jobs)->default_value(0), "number of files to process in parallel per stage (0 for one per core)")
+    ("log-level", boost::program_options::value<std::string>()->default_value("info"), "least severe messages to log: debug (every stage of every file), info, warning, error or quiet")
+    ("log-format", boost::program_options::value<std::string>()->default_value("text"), "text, or json for one JSON object per line")
+    ("quiet,q", "only log errors")
+    ("stats", boost::program_options::bool_switch(&options.pipeline.stats), "report per-stage throughput when done")
+    ("stats-json", boost::program_options::value(&options.pipeline.stats_json_path), "also write the throughput figures, bytes written and peak RSS to this JSON file")
+    ("cache", boost::program_options::value(&options.pipeline.cache_path), "read and update extracted metadata in this cache file")
+    ("verify-cache", boost::program_options::bool_switch(&options.pipeline.verify_cache), "cross-check cached metadata against the files")
+    ("verify-sidecars", boost::program_options::bool_switch(&options.pipeline.verify_sidecars), "cross-check and time the fast XMP sidecar parser against Exiv2")
+    ("memory-budget", boost::program_options::value(&options.pipeline.memory_budget_mb)->default_value(0), "estimated MiB of files being imported (image headers, sidecars, metadata and profiles) that may be in flight at once; new files wait while it is used up (0 for no limit)")
+    ("watch", boost::program_options::bool_switch(&options.watch), "after importing, keep watching input directories and re-import images whose raw or sidecar changes, until interrupted")
+    ("debounce", boost::program_options::value(&options.debounce_ms)->default_value(100), "milliseconds a changed file must stay untouched before it is re-imported with --watch")
+    ("serve", boost::program_options::value(&options.serve), "instead of importing inputs, serve import requests as JSON lines on this UNIX socket (- for stdin/stdout)")
     ;
     // clang-format on
     boost::program_options::positional_options_description p;
@@ -33,72 +41,29 @@ auto parse_options(int argc, char* const* argv) {
         boost::program_options::command_line_parser(argc, argv).options(o).positional(p).run(), v);
     boost::program_options::notify(v);
 
-    if (v.count("help")) {
-        std::cerr << o << std::endl;
-        exit(1);
-    }
-
-    return options;
-}
-
-class source_file_t {
-   public:
-    explicit source_file_t(boost::filesystem::path path) : path_{std::move(path)} {}
+    options.extensions = parse_extensions(v["extensions"].as<std::string>());
 
-    bool is_xmp() const { return boost::iequals(path_.extension().string(), ".xmp"); }
-
-    std::unique_ptr<metadata_t> load_metadata() {
-        try {
-            return std::make_unique<metadata_t>(path_);
-        } catch (Exiv2::AnyError const&) {
-            return nullptr;
-        }
+    try {
+        if (v.count("shard")) options.pipeline.shard = shard_t::parse(v["shard"].as<std::string>());
+        options.log.level = v.count("quiet") ? log_level_t::error : parse_log_level(v["log-level"].as<std::string>());
+        options.log.format = parse_log_format(v["log-format"].as<std::string>());
+    } catch (std::invalid_argument const& e) {
+        std::cerr << e.what() << std::endl;
+        exit(1);
     }
 
-   private:
-    boost::filesystem::path path_;
-};
-
-void import(metadata_t const& metadata, settings_t& settings) {
-    import_tags(metadata, settings);
-    import_development(metadata, settings);
-    import_crop(metadata, settings);
-}
-
-void process_file(boost::filesystem::path const& path, bool force) {
-    source_file_t source{path};
-    if (source.is_xmp()) return;
-    auto metadata = source.load_metadata();
-    if (!metadata) return;
-    if (!metadata->is_lightroom() && !force) {
-        std::cerr << path << " does not appear to be a lightroom file; skipping" << std::endl;
-        return;
+    if (v.count("help") || (options.inputs.empty() && options.files_from.empty() && options.catalog.empty() &&
+                            options.serve.empty()) ||
+        (options.pipeline.verify_cache && options.pipeline.cache_path.empty())) {
+        std::cerr << o << std::endl;
+        exit(1);
     }
-    // std::cerr << *metadata;
-    settings_t settings;
-    settings.load(path);
-    import(*metadata, settings);
-    if (!settings.empty()) settings.commit_by(path);
-}
 
-void process_directory(boost::filesystem::path const& path, bool force) {
-    for (boost::filesystem::recursive_directory_iterator i{path};
-         i != boost::filesystem::recursive_directory_iterator{};
-         ++i)
-        process_file(*i, force);
+    return options;
 }
 
 int main(int argc, char* argv[]) {
-    auto options = parse_options(argc, argv);
-    for (auto&& input : options.inputs) {
-        try {
-            auto path = boost::filesystem::canonical(input);
-            if (boost::filesystem::is_directory(path))
-                process_directory(path, options.force);
-            else
-                process_file(path, options.force);
-        } catch (boost::filesystem::filesystem_error const& e) {
-            std::cerr << "Couldn't find " << input << ": " << e.what() << std::endl;
-        }
-    }
-}
\ No newline at end of file
+    auto status = run(parse_options(argc, argv));
+    flush_log();
+    return status;
+}
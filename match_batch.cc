@@ -0,0 +1,276 @@
+#include "match_batch.h"
+
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "histograms.h"
+#include "json.h"
+#include "preview.h"
+#include "render.h"
+#include "settings.h"
+#include "temp_directory.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct batch_item_t {
+    boost::filesystem::path image;
+    boost::filesystem::path settings;
+    boost::filesystem::path target;  // empty for the image's embedded preview
+};
+
+struct batch_result_t {
+    batch_item_t item;
+    std::optional<double> error;
+    std::string message;
+    double decode_seconds = 0;
+    double render_seconds = 0;
+};
+
+double seconds_since(clock_type::time_point start) {
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+void read_manifest(boost::filesystem::path const& manifest,
+                   bool preview_targets,
+                   std::function<bool(batch_item_t)> const& emit) {
+    boost::filesystem::ifstream i{manifest};
+    if (!i.is_open()) throw std::runtime_error("Couldn't open manifest " + manifest.string());
+    auto base = manifest.parent_path();
+    auto resolve = [&](std::string const& x) { return boost::filesystem::absolute(x, base); };
+    auto resolve_target = [&](std::string const& x) {
+        return preview_targets || x.empty() ? boost::filesystem::path{} : resolve(x);
+    };
+    std::string line;
+    while (std::getline(i, line)) {
+        boost::trim_right_if(line, boost::is_any_of("\r"));
+        if (line.empty() || line[0] == '#') continue;
+        std::vector<std::string> fields;
+        boost::split(fields, line, boost::is_any_of("\t"));
+        batch_item_t item;
+        if (fields.size() == 1) {
+            item.image = resolve(fields[0]);
+            item.settings = pp3_path(item.image);
+        } else if (fields.size() == 2) {
+            item.image = resolve(fields[0]);
+            item.settings = pp3_path(item.image);
+            item.target = resolve_target(fields[1]);
+        } else if (fields.size() == 3) {
+            item.image = resolve(fields[0]);
+            item.settings = fields[1].empty() ? pp3_path(item.image) : resolve(fields[1]);
+            item.target = resolve_target(fields[2]);
+        } else {
+            std::cerr << "Ignoring malformed manifest line: " << line << std::endl;
+            continue;
+        }
+        if (!emit(std::move(item))) return;
+    }
+}
+
+void scan_directory(boost::filesystem::path const& directory,
+                    std::string const& target_extension,
+                    bool preview_targets,
+                    std::function<bool(batch_item_t)> const& emit) {
+    for (boost::filesystem::recursive_directory_iterator i{directory};
+         i != boost::filesystem::recursive_directory_iterator{};
+         ++i) {
+        auto const& settings = i->path();
+        if (!boost::iequals(settings.extension().string(), ".pp3")) continue;
+        if (!boost::filesystem::is_regular_file(settings)) continue;
+        auto image = settings.parent_path() / settings.stem();
+        if (!boost::filesystem::is_regular_file(image)) continue;
+        if (preview_targets) {
+            if (!emit(batch_item_t{image, settings, {}})) return;
+            continue;
+        }
+        auto target = image;
+        target.replace_extension(target_extension);
+        if (!boost::filesystem::is_regular_file(target)) continue;
+        if (!emit(batch_item_t{image, settings, target})) return;
+    }
+}
+
+void evaluate(batch_result_t& result, unsigned preview_scale, boost::filesystem::path const& working_directory) {
+    auto start = clock_type::now();
+    cimg_library::CImg<uint8_t> preview;
+    std::optional<histograms> target_histograms;
+    if (result.item.target.empty()) {
+        preview = read_preview(result.item.image, preview_scale);
+        target_histograms.emplace(preview);
+    } else {
+        target_histograms.emplace(cimg_library::CImg<float>(result.item.target.c_str()));
+    }
+    result.decode_seconds = seconds_since(start);
+
+    settings_t settings;
+    settings.read(result.item.settings);
+    start = clock_type::now();
+    auto rendered = render(result.item.image, settings, working_directory);
+    result.render_seconds = seconds_since(start);
+    if (!preview.is_empty()) match_preview_size(rendered, preview);
+    histograms rendered_histograms(rendered);
+    result.error = target_histograms->error(rendered_histograms);
+}
+
+std::string target_name(batch_item_t const& item) {
+    return item.target.empty() ? "preview" : item.target.string();
+}
+
+std::string csv_field(std::string const& x) {
+    if (x.find_first_of(",\"\n\r") == std::string::npos) return x;
+    return "\"" + boost::replace_all_copy(x, "\"", "\"\"") + "\"";
+}
+
+struct aggregate_t {
+    std::size_t count = 0;
+    std::size_t failed = 0;
+    double mean = 0;
+    double stddev = 0;
+    double min = 0;
+    double median = 0;
+    double max = 0;
+    double decode_seconds = 0;
+    double render_seconds = 0;
+    double wall_seconds = 0;
+
+    aggregate_t(std::vector<batch_result_t> const& results, double wall) : wall_seconds{wall} {
+        std::vector<double> errors;
+        for (auto&& result : results) {
+            ++count;
+            decode_seconds += result.decode_seconds;
+            render_seconds += result.render_seconds;
+            if (!result.error)
+                ++failed;
+            else if (std::isfinite(*result.error))  // a degenerate target can't be ranked against the others
+                errors.push_back(*result.error);
+        }
+        if (errors.empty()) return;
+        std::sort(errors.begin(), errors.end());
+        min = errors.front();
+        max = errors.back();
+        median = (errors.size() % 2) ? errors[errors.size() / 2]
+                                     : (errors[errors.size() / 2 - 1] + errors[errors.size() / 2]) / 2;
+        for (auto x : errors) mean += x;
+        mean /= errors.size();
+        for (auto x : errors) stddev += (x - mean) * (x - mean);
+        stddev = std::sqrt(stddev / errors.size());
+    }
+
+    friend std::ostream& operator<<(std::ostream& s, aggregate_t const& a) {
+        s << "Evaluated " << a.count << " images (" << a.failed << " failed) in " << a.wall_seconds << "s";
+        if (a.wall_seconds > 0) s << " (" << a.count / a.wall_seconds << " images/s)";
+        s << std::endl;
+        s << "Error mean " << a.mean << ", stddev " << a.stddev << ", min " << a.min << ", median " << a.median
+          << ", max " << a.max << std::endl;
+        return s;
+    }
+};
+
+void write_json(boost::filesystem::path const& path,
+                std::vector<batch_result_t> const& results,
+                aggregate_t const& aggregate) {
+    boost::filesystem::ofstream o{path};
+    o << "{\n  \"images\": [";
+    bool any = false;
+    for (auto&& result : results) {
+        if (any) o << ",";
+        o << "\n    {\"image\": " << json_string(result.item.image.string())
+          << ", \"settings\": " << json_string(result.item.settings.string())
+          << ", \"target\": " << json_string(target_name(result.item))
+          << ", \"error\": " << (result.error ? json_number(*result.error) : "null")
+          << ", \"decode_seconds\": " << json_number(result.decode_seconds)
+          << ", \"render_seconds\": " << json_number(result.render_seconds)
+          << ", \"message\": " << json_string(result.message) << "}";
+        any = true;
+    }
+    o << "\n  ],\n  \"aggregate\": {\"count\": " << aggregate.count << ", \"failed\": " << aggregate.failed
+      << ", \"mean\": " << json_number(aggregate.mean) << ", \"stddev\": " << json_number(aggregate.stddev)
+      << ", \"min\": " << json_number(aggregate.min) << ", \"median\": " << json_number(aggregate.median)
+      << ", \"max\": " << json_number(aggregate.max)
+      << ", \"decode_seconds\": " << json_number(aggregate.decode_seconds)
+      << ", \"render_seconds\": " << json_number(aggregate.render_seconds)
+      << ", \"wall_seconds\": " << json_number(aggregate.wall_seconds) << "}\n}\n";
+}
+
+}  // namespace
+
+std::size_t run_batch(batch_options_t const& options) {
+    auto start = clock_type::now();
+    auto jobs = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    bounded_queue<batch_item_t> items{2 * jobs};
+    bounded_queue<batch_result_t> results{2 * jobs};
+
+    std::thread producer{[&] {
+        auto emit = [&](batch_item_t item) { return items.push(std::move(item)); };
+        try {
+            if (boost::filesystem::is_directory(options.source))
+                scan_directory(options.source, options.target_extension, options.preview_targets, emit);
+            else
+                read_manifest(options.source, options.preview_targets, emit);
+        } catch (std::exception const& e) {
+            std::cerr << e.what() << std::endl;
+        }
+        items.close();
+    }};
+
+    std::vector<std::thread> workers;
+    for (unsigned n = 0; n < jobs; ++n) {
+        workers.emplace_back([&] {
+            // Each worker renders into its own scratch directory, since render() uses fixed file names
+            temp_directory temp;
+            while (auto item = items.pop()) {
+                batch_result_t result{std::move(*item)};
+                try {
+                    evaluate(result, options.preview_scale, temp);
+                } catch (std::exception const& e) {
+                    result.error.reset();
+                    result.message = e.what();
+                }
+                results.push(std::move(result));
+            }
+        });
+    }
+
+    std::thread finisher{[&] {
+        for (auto&& worker : workers) worker.join();
+        results.close();
+    }};
+
+    boost::filesystem::ofstream csv;
+    if (!options.csv_path.empty()) {
+        csv.open(options.csv_path);
+        csv << "image,settings,target,error,decode_seconds,render_seconds,message" << std::endl;
+    }
+    std::vector<batch_result_t> all;
+    while (auto result = results.pop()) {
+        if (result->error)
+            std::cerr << result->item.image << ": " << *result->error << std::endl;
+        else
+            std::cerr << result->item.image << ": failed: " << result->message << std::endl;
+        if (csv.is_open()) {
+            csv << csv_field(result->item.image.string()) << "," << csv_field(result->item.settings.string()) << ","
+                << csv_field(target_name(result->item)) << ",";
+            if (result->error) csv << *result->error;
+            csv << "," << result->decode_seconds << "," << result->render_seconds << "," << csv_field(result->message)
+                << "\n";
+        }
+        all.push_back(std::move(*result));
+    }
+    producer.join();
+    finisher.join();
+
+    aggregate_t aggregate{all, seconds_since(start)};
+    std::cerr << aggregate;
+    if (!options.json_path.empty()) write_json(options.json_path, all, aggregate);
+    return aggregate.failed;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <string>
+
+struct batch_options_t {
+    // Manifest file (one "image<TAB>target" or "image<TAB>pp3<TAB>target" per line) or a directory to scan for
+    // "<image>.pp3" profiles with a matching "<image stem><target_extension>" export next to them. A manifest line
+    // with just the image, or an empty target, is scored against the image's embedded preview.
+    boost::filesystem::path source;
+    std::string target_extension = ".jpg";
+    // Score every image against its embedded preview instead of an exported target, decoded at 1/preview_scale
+    bool preview_targets = false;
+    unsigned preview_scale = 1;
+    unsigned jobs = 0;
+    boost::filesystem::path csv_path;
+    boost::filesystem::path json_path;
+};
+
+// Renders and scores every (image, profile, target) triple from options.source on a pool of workers, writing
+// per-image and aggregate error statistics. Returns the number of triples that could not be evaluated.
+std::size_t run_batch(batch_options_t const& options);
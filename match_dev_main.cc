@@ -2,6 +2,9 @@
 #include <boost/program_options.hpp>
 #include <iostream>
 
+#include "histograms.h"
+#include "match_batch.h"
+#include "preview.h"
 #include "render.h"
 #include "settings.h"
 #include "temp_directory.h"
@@ -9,6 +12,7 @@
 struct options_t {
     std::string image_path;
     std::string target_path;
+    batch_options_t batch;
 };
 
 auto parse_options(int argc, char* const* argv) {
@@ -18,8 +22,15 @@ auto parse_options(int argc, char* const* argv) {
     // clang-format off
     o.add_options()
     ("help", "show this help message")
-    ("image,i", boost::program_options::value(&options.image_path)->required(), "image file")
-    ("target,t", boost::program_options::value(&options.target_path)->required(), "image file with target development")
+    ("image,i", boost::program_options::value(&options.image_path), "image file")
+    ("target,t", boost::program_options::value(&options.target_path), "image file with target development")
+    ("preview-targets,p", boost::program_options::bool_switch(&options.batch.preview_targets), "use the image's embedded preview (e.g. a Lightroom-updated DNG's) as the target instead of a file")
+    ("preview-scale", boost::program_options::value(&options.batch.preview_scale)->default_value(options.batch.preview_scale), "decode previews at 1/N of their size, where N is 1, 2, 4 or 8")
+    ("batch,b", boost::program_options::value(&options.batch.source), "manifest file or directory of images to evaluate")
+    ("target-ext", boost::program_options::value(&options.batch.target_extension)->default_value(options.batch.target_extension), "extension of target files when scanning a batch directory")
+    ("jobs,j", boost::program_options::value(&options.batch.jobs)->default_value(0), "number of images to evaluate in parallel in batch mode (0 for one per core)")
+    ("csv", boost::program_options::value(&options.batch.csv_path), "write per-image batch results to this CSV file")
+    ("json", boost::program_options::value(&options.batch.json_path), "write per-image and aggregate batch results to this JSON file")
     ;
     // clang-format on
 
@@ -27,51 +38,33 @@ auto parse_options(int argc, char* const* argv) {
     boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(o).run(), v);
     boost::program_options::notify(v);
 
-    if (v.count("help")) {
+    auto has_target = !options.target_path.empty() || options.batch.preview_targets;
+    if (v.count("help") || (options.batch.source.empty() && (options.image_path.empty() || !has_target))) {
         std::cerr << o << std::endl;
         exit(1);
     }
+    if (options.batch.preview_scale == 0 || options.batch.preview_scale > 8 ||
+        (options.batch.preview_scale & (options.batch.preview_scale - 1))) {
+        std::cerr << "--preview-scale must be 1, 2, 4 or 8" << std::endl;
+        exit(1);
+    }
 
     return options;
 }
 
-struct histograms {
-    cimg_library::CImg<float> r;
-    cimg_library::CImg<float> g;
-    cimg_library::CImg<float> b;
-    cimg_library::CImg<float> s;
-    cimg_library::CImg<float> i;
-
-    template <typename T>
-    histograms(cimg_library::CImg<T> const& rgb, int level_count, float blur_sigma) {
-        if (rgb.spectrum() != 3) throw std::runtime_error("Image is not RGB");
-        auto hsi = rgb.get_RGBtoHSI();
-        r = rgb.get_shared_channel(0).get_histogram(level_count);
-        r.blur(blur_sigma, false, true);
-        g = rgb.get_shared_channel(1).get_histogram(level_count);
-        g.blur(blur_sigma, false, true);
-        b = rgb.get_shared_channel(2).get_histogram(level_count);
-        b.blur(blur_sigma, false, true);
-        s = hsi.get_shared_channel(1).get_histogram(level_count);
-        s.blur(blur_sigma, false, true);
-        i = hsi.get_shared_channel(2).get_histogram(level_count);
-        i.blur(blur_sigma, false, true);
-    };
-
-    [[nodiscard]] double error(histograms const& other, double wr, double wg, double wb, double ws, double wi) const {
-        return wr * r.MSE(other.r) + wg * g.MSE(other.g) + wb * b.MSE(other.b) + ws * s.MSE(other.s) +
-               wi * i.MSE(other.i);
-    }
-};
-
 int main(int argc, char* argv[]) {
-    temp_directory temp;
     auto options = parse_options(argc, argv);
-    cimg_library::CImg<float> target(options.target_path.c_str());
-    histograms target_histograms(target, 256, 16);
+    if (!options.batch.source.empty()) return run_batch(options.batch) ? 1 : 0;
+    temp_directory temp;
+    cimg_library::CImg<uint8_t> preview;
+    if (options.batch.preview_targets) preview = read_preview(options.image_path, options.batch.preview_scale);
+    auto target_histograms = options.batch.preview_targets
+                                 ? histograms(preview)
+                                 : histograms(cimg_library::CImg<float>(options.target_path.c_str()));
     settings_t settings;
     settings.load(options.image_path);
     auto rendered = render(options.image_path, settings, temp);
-    histograms rendered_histograms(rendered, 256, 16);
-    std::cerr << "Rendered : " << target_histograms.error(rendered_histograms, 1, 1, 1, 2, 2) << std::endl;
-}
\ No newline at end of file
+    if (options.batch.preview_targets) match_preview_size(rendered, preview);
+    histograms rendered_histograms(rendered);
+    std::cerr << "Rendered : " << target_histograms.error(rendered_histograms) << std::endl;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+// Caps the estimated memory of the work in flight. acquire() blocks while admitting more would go over the budget,
+// unless nothing else is in flight, so that work larger than the whole budget still gets through on its own. A
+// budget of 0 admits everything.
+class memory_budget_t {
+   public:
+    // Memory admitted by acquire(), given back on release() or destruction
+    class reservation_t {
+       public:
+        reservation_t() = default;
+        reservation_t(reservation_t&& x) noexcept : budget_{x.budget_}, bytes_{x.bytes_} { x.budget_ = nullptr; }
+        reservation_t& operator=(reservation_t&& x) noexcept {
+            if (this != &x) {
+                release();
+                budget_ = x.budget_;
+                bytes_ = x.bytes_;
+                x.budget_ = nullptr;
+            }
+            return *this;
+        }
+        ~reservation_t() { release(); }
+
+        void release() {
+            if (budget_) budget_->release(bytes_);
+            budget_ = nullptr;
+        }
+
+        // Gives back all but `bytes`, e.g. once the working memory of a stage is freed
+        void shrink_to(std::size_t bytes) {
+            if (!budget_ || bytes >= bytes_) return;
+            budget_->release(bytes_ - bytes);
+            bytes_ = bytes;
+        }
+
+       private:
+        friend class memory_budget_t;
+        reservation_t(memory_budget_t* budget, std::size_t bytes) : budget_{budget}, bytes_{bytes} {}
+
+        memory_budget_t* budget_ = nullptr;
+        std::size_t bytes_ = 0;
+    };
+
+    explicit memory_budget_t(std::size_t budget) : budget_{budget} {}
+
+    reservation_t acquire(std::size_t bytes) {
+        std::unique_lock lock{mutex_};
+        if (budget_) released_.wait(lock, [&] { return in_flight_ == 0 || in_flight_ + bytes <= budget_; });
+        in_flight_ += bytes;
+        peak_ = std::max(peak_, in_flight_);
+        return reservation_t{this, bytes};
+    }
+
+    // Most memory in flight at once so far
+    [[nodiscard]] std::size_t peak() const {
+        std::lock_guard lock{mutex_};
+        return peak_;
+    }
+
+   private:
+    void release(std::size_t bytes) {
+        {
+            std::lock_guard lock{mutex_};
+            in_flight_ -= bytes;
+        }
+        released_.notify_all();
+    }
+
+    std::size_t const budget_;
+    mutable std::mutex mutex_;
+    std::condition_variable released_;
+    std::size_t in_flight_ = 0;
+    std::size_t peak_ = 0;
+};
@@ -1,20 +1,120 @@
 #include "metadata.h"
 
-metadata_t::metadata_t(boost::filesystem::path const& path) {
-    image_ = Exiv2::ImageFactory::open(path.string());
-    assert(image_);
-    image_->readMetadata();
-    std::cerr << "Read metadata from " << path << std::endl;
-    auto sidecar_path = path;
+#include <boost/filesystem/fstream.hpp>
+
+#include "mmap_io.h"
+#include "xmp_sidecar.h"
+
+namespace {
+
+template <typename TData>
+void record_values(TData const& data, std::map<std::string, value_t>& values) {
+    for (auto&& datum : data) {
+        auto key = datum.key();
+        if (!is_recorded_key(key)) continue;
+        if (auto value = value_t::from(datum.value())) values.emplace(std::move(key), std::move(*value));
+    }
+}
+
+void value_differences(std::string const& source,
+                       std::map<std::string, value_t> const& expected,
+                       std::map<std::string, value_t> const& actual,
+                       std::vector<std::string>& differences) {
+    for (auto&& [key, value] : expected) {
+        auto i = actual.find(key);
+        std::ostringstream o;
+        if (i == actual.end())
+            o << source << " " << key << " missing, expected " << value;
+        else if (i->second != value)
+            o << source << " " << key << " is " << i->second << ", expected " << value;
+        else
+            continue;
+        differences.push_back(o.str());
+    }
+    for (auto&& [key, value] : actual) {
+        if (!expected.count(key)) differences.push_back(source + " " + key + " unexpected");
+    }
+}
+
+}  // namespace
+
+std::vector<std::string> record_differences(metadata_record_t const& expected, metadata_record_t const& actual) {
+    std::vector<std::string> differences;
+    if (expected.width != actual.width || expected.height != actual.height) {
+        std::ostringstream o;
+        o << "size is " << actual.width << "x" << actual.height << ", expected " << expected.width << "x"
+          << expected.height;
+        differences.push_back(o.str());
+    }
+    value_differences("file", expected.image, actual.image, differences);
+    value_differences("sidecar", expected.sidecar, actual.sidecar, differences);
+    return differences;
+}
+
+// Structured members (e.g. local adjustments) are never asked for
+bool is_recorded_key(std::string const& key) {
+    static std::string const prefixes[] = {"Xmp.crs.", "Xmp.dc.", "Xmp.lr.", "Xmp.tiff.", "Xmp.xmp."};
+    if (key == "Exif.Image.Orientation") return true;
+    if (key.find_first_of("[/") != std::string::npos) return false;
+    for (auto&& prefix : prefixes)
+        if (boost::starts_with(key, prefix)) return true;
+    return false;
+}
+
+boost::filesystem::path xmp_sidecar_path(boost::filesystem::path const& image_path) {
+    auto sidecar_path = image_path;
     sidecar_path.replace_extension(".xmp");
-    if (boost::filesystem::is_regular_file(sidecar_path)) {
-        try {
-            sidecar_ = Exiv2::ImageFactory::open(sidecar_path.string());
-        } catch (Exiv2::AnyError const&) {
-        }
+    return sidecar_path;
+}
+
+metadata_record_t record_from_blocks(std::string const& exif,
+                                     std::string const& xmp,
+                                     std::optional<std::string> const& sidecar_packet,
+                                     long width,
+                                     long height) {
+    metadata_record_t record;
+    record.width = width;
+    record.height = height;
+    if (!exif.empty()) {
+        Exiv2::ExifData exif_data;
+        Exiv2::ExifParser::decode(exif_data, reinterpret_cast<Exiv2::byte const*>(exif.data()), exif.size());
+        record_values(exif_data, record.image);
     }
-    if (sidecar_) {
-        sidecar_->readMetadata();
-        std::cerr << "Read metadata from sidecar " << sidecar_path << std::endl;
+    if (!xmp.empty()) {
+        for (auto&& [key, value] : parse_xmp(xmp)) record.image.emplace(key, value);
     }
+    if (sidecar_packet) record.sidecar = parse_xmp(*sidecar_packet);
+    return record;
+}
+
+namespace {
+
+// Sidecars that can't be parsed are ignored, like missing ones
+std::map<std::string, value_t> read_sidecar(boost::filesystem::path const& image_path) {
+    auto sidecar_path = xmp_sidecar_path(image_path);
+    if (!boost::filesystem::is_regular_file(sidecar_path)) return {};
+    boost::filesystem::ifstream i{sidecar_path, std::ios::binary};
+    std::string packet{std::istreambuf_iterator<char>{i}, std::istreambuf_iterator<char>{}};
+    try {
+        return parse_xmp(packet);
+    } catch (Exiv2::AnyError const&) {
+        return {};
+    }
+}
+
+}  // namespace
+
+metadata_t::metadata_t(boost::filesystem::path const& path, bool has_sidecar)
+    : metadata_t{Exiv2::BasicIo::AutoPtr{new mmap_io_t{path}},
+                 has_sidecar ? read_sidecar(path) : std::map<std::string, value_t>{}} {}
+
+metadata_t::metadata_t(Exiv2::BasicIo::AutoPtr io, std::map<std::string, value_t> sidecar) {
+    auto image = Exiv2::ImageFactory::open(std::move(io));
+    assert(image.get());
+    image->readMetadata();
+    record_.width = image->pixelWidth();
+    record_.height = image->pixelHeight();
+    record_values(image->xmpData(), record_.image);
+    record_values(image->exifData(), record_.image);
+    record_.sidecar = std::move(sidecar);
 }
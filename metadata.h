@@ -1,39 +1,69 @@
 #pragma once
 
 #include <boost/filesystem.hpp>
+#include <map>
 
 #include "exiv2.h"
 #include "get_value.h"
+#include "value.h"
 
+// Path of the XMP sidecar Lightroom writes for the given image
+boost::filesystem::path xmp_sidecar_path(boost::filesystem::path const& image_path);
+
+// Whether metadata_t records the given key: the ones the importers may read
+bool is_recorded_key(std::string const& key);
+
+// The subset of an image's metadata the importers read, detached from Exiv2
+struct metadata_record_t {
+    long width = 0;
+    long height = 0;
+    std::map<std::string, value_t> image;
+    std::map<std::string, value_t> sidecar;
+};
+
+// Human-readable list of the ways `actual` differs from `expected`; empty if they are the same
+std::vector<std::string> record_differences(metadata_record_t const& expected, metadata_record_t const& actual);
+
+// Record of metadata blocks already extracted from an image: a TIFF-structured Exif block (the payload of a JPEG APP1
+// segment after "Exif\0\0") and the XMP packet embedded in the image, either of which may be empty, plus the sidecar
+// packet if there is one. The blocks don't tell the sensor size the way Exiv2 reads it from the whole image (the Exif
+// dimensions are often those of a preview or the developed image), so it's passed in: Image::pixelWidth() and
+// pixelHeight() of the image, or 0 if unknown.
+metadata_record_t record_from_blocks(std::string const& exif,
+                                     std::string const& xmp,
+                                     std::optional<std::string> const& sidecar_packet,
+                                     long width,
+                                     long height);
+
+// The values the importers may read from an image and its sidecar. Only the compact record is kept: the Exiv2 image,
+// with all of its Exif, maker notes and previews, is dropped as soon as the record has been extracted from it.
 class metadata_t {
    public:
-    explicit metadata_t(boost::filesystem::path const& path);
+    // Reads the image and, unless it is known not to exist, its XMP sidecar
+    explicit metadata_t(boost::filesystem::path const& path, bool has_sidecar = true);
+    // Reads the image through `io` (e.g. an Exiv2::MemIo over its contents); `sidecar` is its parsed XMP sidecar
+    metadata_t(Exiv2::BasicIo::AutoPtr io, std::map<std::string, value_t> sidecar);
+    explicit metadata_t(metadata_record_t record) : record_{std::move(record)} {}
 
-    [[nodiscard]] auto width() const { return image_->pixelWidth(); }
-    [[nodiscard]] auto height() const { return image_->pixelHeight(); }
+    [[nodiscard]] long width() const { return record_.width; }
+    [[nodiscard]] long height() const { return record_.height; }
 
+    // The values the importers may ask for
+    [[nodiscard]] metadata_record_t const& record() const { return record_; }
+
+    // Sidecar values take precedence over the image's own
     template <typename T>
     [[nodiscard]] std::optional<T> get(std::vector<std::string> const& keys) const {
         std::optional<T> result;
-        if (sidecar_) {
-            for (auto&& key : keys) {
-                if (boost::starts_with(key, "Xmp.")) {
-                    auto i = sidecar_->xmpData().findKey(Exiv2::XmpKey{key});
-                    if (i != sidecar_->xmpData().end()) result = get_value<T>(i->value());
-                    if (result) return result;
-                }
-            }
+        for (auto&& key : keys) {
+            auto i = record_.sidecar.find(key);
+            if (i != record_.sidecar.end()) result = get_value<T>(i->second);
+            if (result) return result;
         }
         for (auto&& key : keys) {
-            if (boost::starts_with(key, "Xmp.")) {
-                auto i = image_->xmpData().findKey(Exiv2::XmpKey{key});
-                if (i != image_->xmpData().end()) result = get_value<T>(i->value());
-                if (result) return result;
-            } else if (boost::starts_with(key, "Exif.")) {
-                auto i = image_->exifData().findKey(Exiv2::ExifKey{key});
-                if (i != image_->exifData().end()) result = get_value<T>(i->value());
-                if (result) return result;
-            }
+            auto i = record_.image.find(key);
+            if (i != record_.image.end()) result = get_value<T>(i->second);
+            if (result) return result;
         }
         return std::nullopt;
     }
@@ -50,27 +80,13 @@ class metadata_t {
 
     friend std::ostream& operator<<(std::ostream& s, metadata_t const& m) {
         s << "WxH: " << m.width() << "x" << m.height() << std::endl;
-        s << "EXIF from file:" << std::endl;
-        for (auto&& datum : m.image_->exifData()) {
-            s << datum.key() << ": " << datum.value().toString() << " ("
-              << Exiv2::TypeInfo::typeName(datum.value().typeId()) << ")" << std::endl;
-        }
-        s << "XMP from file:" << std::endl;
-        for (auto&& datum : m.image_->xmpData()) {
-            s << datum.key() << ": " << datum.value().toString() << " ("
-              << Exiv2::TypeInfo::typeName(datum.value().typeId()) << ")" << std::endl;
-        }
-        if (m.sidecar_) {
-            s << "XMP from sidecar:" << std::endl;
-            for (auto&& datum : m.sidecar_->xmpData()) {
-                s << datum.key() << ": " << datum.value().toString() << " ("
-                  << Exiv2::TypeInfo::typeName(datum.value().typeId()) << ")" << std::endl;
-            }
-        }
+        s << "Recorded from file:" << std::endl;
+        for (auto&& [key, value] : m.record_.image) s << key << ": " << value << std::endl;
+        s << "Recorded from sidecar:" << std::endl;
+        for (auto&& [key, value] : m.record_.sidecar) s << key << ": " << value << std::endl;
         return s;
     }
 
    private:
-    std::unique_ptr<Exiv2::Image> image_;
-    std::unique_ptr<Exiv2::Image> sidecar_;
+    metadata_record_t record_;
 };
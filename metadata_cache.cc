@@ -0,0 +1,294 @@
+#include "metadata_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <boost/filesystem/fstream.hpp>
+#include <cstring>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "log.h"
+#include "stable_hash.h"
+
+namespace {
+
+char const magic[8] = {'L', 'R', '2', 'R', 'T', 'M', 'C', '\0'};
+// Bump whenever the layout or how records are produced changes, so that older caches are ignored rather than served.
+// 2: sidecars are parsed by the fast XMP reader.
+std::uint32_t const version = 2;
+
+struct header_t {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t count;
+    std::uint64_t index_offset;
+};
+
+class encoder_t {
+   public:
+    template <typename T>
+    void put(T x) {
+        data_.append(reinterpret_cast<char const*>(&x), sizeof(x));
+    }
+
+    void put(std::string const& x) {
+        put(static_cast<std::uint32_t>(x.size()));
+        data_.append(x);
+    }
+
+    void put(std::map<std::string, value_t> const& values) {
+        put(static_cast<std::uint32_t>(values.size()));
+        for (auto&& [key, value] : values) {
+            put(key);
+            put(static_cast<std::uint8_t>(value.kind));
+            put(value.number);
+            put(static_cast<std::uint32_t>(value.items.size()));
+            for (auto&& item : value.items) put(item);
+        }
+    }
+
+    std::string& data() { return data_; }
+
+   private:
+    std::string data_;
+};
+
+class decoder_t {
+   public:
+    decoder_t(char const* data, std::size_t size) : p_{data}, end_{data + size} {}
+
+    template <typename T>
+    T get() {
+        T x;
+        std::memcpy(&x, take(sizeof(x)), sizeof(x));
+        return x;
+    }
+
+    std::string get_string() {
+        auto size = get<std::uint32_t>();
+        return std::string(take(size), size);
+    }
+
+    std::map<std::string, value_t> get_values() {
+        std::map<std::string, value_t> values;
+        auto count = get<std::uint32_t>();
+        for (std::uint32_t n = 0; n < count; ++n) {
+            auto key = get_string();
+            value_t value;
+            // The cache may be corrupt, and visitors of value_t only handle the kinds there are
+            auto kind = get<std::uint8_t>();
+            if (kind > static_cast<std::uint8_t>(value_t::kind_t::list))
+                throw std::runtime_error("corrupt metadata cache record");
+            value.kind = static_cast<value_t::kind_t>(kind);
+            value.number = get<double>();
+            auto item_count = get<std::uint32_t>();
+            for (std::uint32_t i = 0; i < item_count; ++i) value.items.push_back(get_string());
+            values.emplace(std::move(key), std::move(value));
+        }
+        return values;
+    }
+
+    [[nodiscard]] bool done() const { return p_ == end_; }
+
+   private:
+    char const* take(std::size_t size) {
+        if (std::size_t(end_ - p_) < size) throw std::runtime_error("truncated metadata cache record");
+        auto p = p_;
+        p_ += size;
+        return p;
+    }
+
+    char const* p_;
+    char const* end_;
+};
+
+std::string encode(metadata_record_t const& record) {
+    encoder_t e;
+    e.put(static_cast<std::int64_t>(record.width));
+    e.put(static_cast<std::int64_t>(record.height));
+    e.put(record.image);
+    e.put(record.sidecar);
+    return std::move(e.data());
+}
+
+metadata_record_t decode(char const* data, std::size_t size) {
+    decoder_t d{data, size};
+    metadata_record_t record;
+    record.width = d.get<std::int64_t>();
+    record.height = d.get<std::int64_t>();
+    record.image = d.get_values();
+    record.sidecar = d.get_values();
+    if (!d.done()) throw std::runtime_error("corrupt metadata cache record");
+    return record;
+}
+
+std::int64_t modification_ns(struct stat const& s) {
+#if TARGET_OS_IS_APPLE
+    return std::int64_t(s.st_mtimespec.tv_sec) * 1000000000 + s.st_mtimespec.tv_nsec;
+#else
+    return std::int64_t(s.st_mtim.tv_sec) * 1000000000 + s.st_mtim.tv_nsec;
+#endif
+}
+
+}  // namespace
+
+metadata_cache_t::stamp_t metadata_cache_t::stamp_t::of(boost::filesystem::path const& source) {
+    stamp_t stamp;
+    struct stat s {};
+    if (::stat(source.c_str(), &s) == 0) {
+        stamp.size = s.st_size;
+        stamp.mtime_ns = modification_ns(s);
+    }
+    if (::stat(xmp_sidecar_path(source).c_str(), &s) == 0) {
+        stamp.sidecar_size = s.st_size;
+        stamp.sidecar_mtime_ns = modification_ns(s);
+    }
+    return stamp;
+}
+
+metadata_cache_t::metadata_cache_t(boost::filesystem::path path) : path_{std::move(path)} {
+    auto fd = ::open(path_.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat s {};
+    if (::fstat(fd, &s) == 0 && std::size_t(s.st_size) >= sizeof(header_t)) {
+        auto p = ::mmap(nullptr, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            data_ = static_cast<char const*>(p);
+            size_ = s.st_size;
+        }
+    }
+    ::close(fd);
+    if (!data_) return;
+
+    header_t header{};
+    std::memcpy(&header, data_, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version ||
+        header.index_offset % alignof(index_entry_t) != 0 || header.index_offset > size_ ||
+        (size_ - header.index_offset) / sizeof(index_entry_t) < header.count) {
+        log_message(log_level_t::warning, "Ignoring incompatible metadata cache ", path_);
+        return;
+    }
+    index_ = reinterpret_cast<index_entry_t const*>(data_ + header.index_offset);
+    count_ = header.count;
+}
+
+metadata_cache_t::~metadata_cache_t() {
+    if (data_) ::munmap(const_cast<char*>(data_), size_);
+}
+
+metadata_cache_t::index_entry_t const* metadata_cache_t::find_mapped(std::string const& path) const {
+    auto hash = stable_hash(path);
+    auto end = index_ + count_;
+    for (auto i = std::lower_bound(index_, end, hash, [](auto&& e, auto h) { return e.hash < h; });
+         i != end && i->hash == hash;
+         ++i) {
+        if (i->path_offset + i->path_length > size_ || i->record_offset + i->record_length > size_) return nullptr;
+        if (std::string_view(data_ + i->path_offset, i->path_length) == path) return i;
+    }
+    return nullptr;
+}
+
+std::optional<metadata_record_t> metadata_cache_t::find(boost::filesystem::path const& source) const {
+    auto path = source.string();
+    auto stamp = stamp_t::of(source);
+    {
+        std::lock_guard lock{mutex_};
+        auto i = pending_.find(path);
+        if (i != pending_.end()) {
+            if (!(i->second.stamp == stamp)) return std::nullopt;
+            return decode(i->second.record.data(), i->second.record.size());
+        }
+    }
+    auto entry = find_mapped(path);
+    if (!entry || !(entry->stamp == stamp)) return std::nullopt;
+    try {
+        return decode(data_ + entry->record_offset, entry->record_length);
+    } catch (std::runtime_error const& e) {
+        log_message(log_level_t::warning, "Ignoring cached metadata for ", source, ": ", e.what());
+        return std::nullopt;
+    }
+}
+
+bool metadata_cache_t::contains(boost::filesystem::path const& source) const {
+    auto path = source.string();
+    auto stamp = stamp_t::of(source);
+    {
+        std::lock_guard lock{mutex_};
+        auto i = pending_.find(path);
+        if (i != pending_.end()) return i->second.stamp == stamp;
+    }
+    auto entry = find_mapped(path);
+    return entry && entry->stamp == stamp;
+}
+
+void metadata_cache_t::insert(boost::filesystem::path const& source, metadata_record_t const& record) {
+    auto stamp = stamp_t::of(source);
+    auto encoded = encode(record);
+    std::lock_guard lock{mutex_};
+    pending_[source.string()] = pending_t{stamp, std::move(encoded)};
+}
+
+void metadata_cache_t::save() {
+    std::lock_guard lock{mutex_};
+    if (pending_.empty()) return;
+
+    struct entry_t {
+        std::uint64_t hash;
+        std::string_view path;
+        stamp_t stamp;
+        std::string_view record;
+    };
+    std::vector<entry_t> entries;
+    for (auto&& [path, pending] : pending_) entries.push_back({stable_hash(path), path, pending.stamp, pending.record});
+    for (std::size_t n = 0; n < count_; ++n) {
+        auto&& e = index_[n];
+        if (e.path_offset + e.path_length > size_ || e.record_offset + e.record_length > size_) continue;
+        std::string_view path{data_ + e.path_offset, e.path_length};
+        if (pending_.count(std::string(path))) continue;
+        entries.push_back({e.hash, path, e.stamp, {data_ + e.record_offset, e.record_length}});
+    }
+    std::sort(entries.begin(), entries.end(), [](auto&& a, auto&& b) {
+        return std::tie(a.hash, a.path) < std::tie(b.hash, b.path);
+    });
+
+    std::string blobs;
+    std::vector<index_entry_t> index;
+    for (auto&& e : entries) {
+        index_entry_t i{};
+        i.hash = e.hash;
+        i.path_offset = sizeof(header_t) + blobs.size();
+        i.path_length = e.path.size();
+        blobs.append(e.path);
+        i.record_offset = sizeof(header_t) + blobs.size();
+        i.record_length = e.record.size();
+        blobs.append(e.record);
+        i.stamp = e.stamp;
+        index.push_back(i);
+    }
+    blobs.resize((sizeof(header_t) + blobs.size() + alignof(index_entry_t) - 1) / alignof(index_entry_t) *
+                     alignof(index_entry_t) -
+                 sizeof(header_t));
+
+    header_t header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.count = index.size();
+    header.index_offset = sizeof(header_t) + blobs.size();
+
+    // Write beside the old file and rename over it, so the mapping stays valid and readers never see a partial cache
+    auto temp_path = path_;
+    temp_path += ".tmp";
+    {
+        boost::filesystem::ofstream o{temp_path, std::ios::binary | std::ios::trunc};
+        o.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        o.write(blobs.data(), blobs.size());
+        o.write(reinterpret_cast<char const*>(index.data()), index.size() * sizeof(index_entry_t));
+        if (!o) throw std::runtime_error("Couldn't write metadata cache " + temp_path.string());
+    }
+    boost::filesystem::rename(temp_path, path_);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "metadata.h"
+
+// Persistent cache of metadata_record_t, keyed by source path and validated against the size and modification time of
+// the image and its sidecar. The cache file is memory-mapped when opened, so lookups on a warm run decode just the
+// records asked for and never touch Exiv2. New records are kept in memory until save() rewrites the file.
+//
+// File layout (native byte order):
+//   header   "LR2RTMC" magic, format version, entry count, offset of the index
+//   blobs    for each entry, its source path followed by its encoded record
+//   index    fixed-size entries sorted by (path hash, path), binary-searched on lookup
+class metadata_cache_t {
+   public:
+    explicit metadata_cache_t(boost::filesystem::path path);
+    ~metadata_cache_t();
+    metadata_cache_t(metadata_cache_t const&) = delete;
+    metadata_cache_t& operator=(metadata_cache_t const&) = delete;
+
+    [[nodiscard]] std::optional<metadata_record_t> find(boost::filesystem::path const& source) const;
+    // Whether find() would return a record, without decoding it
+    [[nodiscard]] bool contains(boost::filesystem::path const& source) const;
+    void insert(boost::filesystem::path const& source, metadata_record_t const& record);
+    void save();
+
+   private:
+    struct stamp_t {
+        std::int64_t size = -1;
+        std::int64_t mtime_ns = 0;
+        std::int64_t sidecar_size = -1;
+        std::int64_t sidecar_mtime_ns = 0;
+
+        static stamp_t of(boost::filesystem::path const& source);
+        friend bool operator==(stamp_t const& a, stamp_t const& b) {
+            return a.size == b.size && a.mtime_ns == b.mtime_ns && a.sidecar_size == b.sidecar_size &&
+                   a.sidecar_mtime_ns == b.sidecar_mtime_ns;
+        }
+    };
+
+    struct index_entry_t {
+        std::uint64_t hash;
+        std::uint64_t path_offset;
+        std::uint64_t record_offset;
+        std::uint32_t path_length;
+        std::uint32_t record_length;
+        stamp_t stamp;
+    };
+
+    struct pending_t {
+        stamp_t stamp;
+        std::string record;
+    };
+
+    [[nodiscard]] index_entry_t const* find_mapped(std::string const& path) const;
+
+    boost::filesystem::path path_;
+    char const* data_ = nullptr;
+    std::size_t size_ = 0;
+    index_entry_t const* index_ = nullptr;
+    std::size_t count_ = 0;
+    mutable std::mutex mutex_;
+    std::map<std::string, pending_t> pending_;
+};
@@ -0,0 +1,189 @@
+#include "mmap_io.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+struct atomic_totals_t {
+    std::atomic<std::uint64_t> files{0};
+    std::atomic<std::uint64_t> bytes_mapped{0};
+    std::atomic<std::uint64_t> bytes_faulted{0};
+    std::atomic<std::uint64_t> header_only{0};
+};
+
+atomic_totals_t& atomic_totals() {
+    static atomic_totals_t totals;
+    return totals;
+}
+
+std::size_t page_size() {
+    static std::size_t const size = ::sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+}  // namespace
+
+mmap_io_t::mmap_io_t(boost::filesystem::path path) : path_{std::move(path)} {}
+
+mmap_io_t::~mmap_io_t() { close(); }
+
+mmap_io_t::totals_t mmap_io_t::totals() {
+    auto&& t = atomic_totals();
+    return totals_t{t.files, t.bytes_mapped, t.bytes_faulted, t.header_only};
+}
+
+std::vector<bool> mmap_io_t::resident_pages() const {
+    std::vector<bool> result;
+    if (!data_) return result;
+    auto count = (size_ + page_size() - 1) / page_size();
+#if TARGET_OS_IS_APPLE
+    std::vector<char> pages(count);
+#else
+    std::vector<unsigned char> pages(count);
+#endif
+    if (::mincore(data_, size_, pages.data()) != 0) return result;
+    result.reserve(count);
+    for (auto page : pages) result.push_back(page & 1);
+    return result;
+}
+
+int mmap_io_t::open() {
+    close();
+    fd_ = ::open(path_.c_str(), O_RDONLY);
+    if (fd_ < 0) return 1;
+    struct stat s {};
+    if (::fstat(fd_, &s) != 0) {
+        close();
+        return 1;
+    }
+    size_ = s.st_size;
+    if (size_ > 0) {
+        auto p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (p == MAP_FAILED) {
+            close();
+            return 1;
+        }
+        data_ = static_cast<Exiv2::byte*>(p);
+        ::madvise(data_, size_, MADV_RANDOM);
+        ::madvise(data_, std::min(size_, header_window), MADV_WILLNEED);
+    }
+    resident_at_open_ = resident_pages();
+    position_ = 0;
+    eof_ = false;
+    return 0;
+}
+
+int mmap_io_t::close() {
+    if (data_) {
+        auto resident = resident_pages();
+        std::uint64_t faulted = 0;
+        std::size_t touched_end = high_water_;
+        for (std::size_t page = 0; page < resident.size() && page < resident_at_open_.size(); ++page) {
+            if (resident[page] && !resident_at_open_[page]) {
+                faulted += page_size();
+                touched_end = std::max(touched_end, (page + 1) * page_size());
+            }
+        }
+        auto&& totals = atomic_totals();
+        totals.bytes_faulted += faulted;
+        if (!counted_) {
+            counted_ = true;
+            ++totals.files;
+            totals.bytes_mapped += size_;
+            if (touched_end <= header_window) ++totals.header_only;
+        }
+        ::munmap(data_, size_);
+        data_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    return 0;
+}
+
+long mmap_io_t::write(Exiv2::byte const*, long) { return 0; }
+
+long mmap_io_t::write(Exiv2::BasicIo&) { return 0; }
+
+int mmap_io_t::putb(Exiv2::byte) { return EOF; }
+
+Exiv2::DataBuf mmap_io_t::read(long rcount) {
+    Exiv2::DataBuf buf(rcount);
+    buf.size_ = read(buf.pData_, rcount);
+    return buf;
+}
+
+long mmap_io_t::read(Exiv2::byte* buf, long rcount) {
+    if (rcount <= 0) return 0;
+    auto available = position_ < size_ ? size_ - position_ : 0;
+    auto count = std::min<std::size_t>(rcount, available);
+    if (count) std::memcpy(buf, data_ + position_, count);
+    position_ += count;
+    high_water_ = std::max(high_water_, position_);
+    if (count < std::size_t(rcount)) eof_ = true;
+    return count;
+}
+
+int mmap_io_t::getb() {
+    if (position_ >= size_) {
+        eof_ = true;
+        return EOF;
+    }
+    high_water_ = std::max(high_water_, position_ + 1);
+    return data_[position_++];
+}
+
+void mmap_io_t::transfer(Exiv2::BasicIo&) {
+    throw Exiv2::Error(Exiv2::kerTransferFailed, path(), "read-only mapping");
+}
+
+int mmap_io_t::seek(long offset, Position pos) {
+    long base = 0;
+    switch (pos) {
+        case beg:
+            break;
+        case cur:
+            base = position_;
+            break;
+        case end:
+            base = size_;
+            break;
+    }
+    auto target = base + offset;
+    if (target < 0 || std::size_t(target) > size_) return 1;
+    position_ = target;
+    eof_ = false;
+    return 0;
+}
+
+Exiv2::byte* mmap_io_t::mmap(bool isWriteable) {
+    if (isWriteable) throw Exiv2::Error(Exiv2::kerFailedToMapFileForReadWrite, path(), "read-only mapping");
+    return data_;
+}
+
+int mmap_io_t::munmap() { return 0; }
+
+long mmap_io_t::tell() const { return position_; }
+
+size_t mmap_io_t::size() const { return size_; }
+
+bool mmap_io_t::isopen() const { return fd_ >= 0; }
+
+int mmap_io_t::error() const { return 0; }
+
+bool mmap_io_t::eof() const { return eof_; }
+
+std::string mmap_io_t::path() const { return path_.string(); }
+
+#ifdef EXV_UNICODE_PATH
+std::wstring mmap_io_t::wpath() const { return path_.wstring(); }
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "exiv2.h"
+
+// Leading part of an image file in which we expect to find all of the metadata we read
+constexpr std::size_t header_window = 1 << 20;
+
+// Read-only Exiv2::BasicIo backed by a private file mapping. The mapping is advised MADV_RANDOM so that Exiv2's
+// scattered IFD reads don't drag in readahead across a 30-80 MB raw; only the header window is prefetched. On close,
+// page residency is sampled to account for how much of the file was actually faulted in, and whether anything beyond
+// the header window was touched.
+class mmap_io_t : public Exiv2::BasicIo {
+   public:
+    struct totals_t {
+        std::uint64_t files = 0;
+        std::uint64_t bytes_mapped = 0;
+        std::uint64_t bytes_faulted = 0;
+        std::uint64_t header_only = 0;
+
+        friend std::ostream& operator<<(std::ostream& s, totals_t const& x) {
+            return s << x.files << " files, " << x.bytes_mapped / 1048576.0 << " MiB mapped, "
+                     << x.bytes_faulted / 1048576.0 << " MiB faulted in, " << x.header_only
+                     << " within the header window";
+        }
+    };
+
+    explicit mmap_io_t(boost::filesystem::path path);
+    ~mmap_io_t() override;
+
+    // Totals over every mmap_io_t closed so far, across all threads
+    static totals_t totals();
+
+    int open() override;
+    int close() override;
+    long write(Exiv2::byte const* data, long wcount) override;
+    long write(Exiv2::BasicIo& src) override;
+    int putb(Exiv2::byte data) override;
+    Exiv2::DataBuf read(long rcount) override;
+    long read(Exiv2::byte* buf, long rcount) override;
+    int getb() override;
+    void transfer(Exiv2::BasicIo& src) override;
+    int seek(long offset, Position pos) override;
+    Exiv2::byte* mmap(bool isWriteable) override;
+    int munmap() override;
+    [[nodiscard]] long tell() const override;
+    [[nodiscard]] size_t size() const override;
+    [[nodiscard]] bool isopen() const override;
+    [[nodiscard]] int error() const override;
+    [[nodiscard]] bool eof() const override;
+    [[nodiscard]] std::string path() const override;
+#ifdef EXV_UNICODE_PATH
+    [[nodiscard]] std::wstring wpath() const override;
+#endif
+    void populateFakeData() override {}
+
+   private:
+    std::vector<bool> resident_pages() const;
+
+    boost::filesystem::path path_;
+    int fd_ = -1;
+    Exiv2::byte* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t position_ = 0;
+    std::size_t high_water_ = 0;
+    bool eof_ = false;
+    std::vector<bool> resident_at_open_;
+    bool counted_ = false;
+};
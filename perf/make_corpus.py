@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Generates the fixed corpus perf/run_perf.py measures against.
+
+Every image is a TIFF-structured raw stand-in (.dng) that Exiv2 reads like a real one, padded out to a raw's size with
+a sparse hole so that the corpus costs next to no disk. Images come with a Lightroom XMP sidecar, some with an
+existing RawTherapee profile to merge into, spread over nested directories along with the JPEG exports and other files
+a real photo tree has. A manifest pairs some images with target renders for match_dev. The output depends only on the
+arguments, so numbers from different runs and machines are comparable.
+"""
+
+import argparse
+import os
+import random
+import struct
+
+XMP_TEMPLATE = """<x:xmpmeta xmlns:x="adobe:ns:meta/" x:xmptk="Adobe XMP Core 5.6-c140">
+ <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">
+  <rdf:Description rdf:about=""
+    xmlns:xmp="http://ns.adobe.com/xap/1.0/"
+    xmlns:tiff="http://ns.adobe.com/tiff/1.0/"
+    xmlns:crs="http://ns.adobe.com/camera-raw-settings/1.0/"
+   xmp:CreatorTool="Adobe Photoshop Lightroom Classic 9.0 (Macintosh)"
+   xmp:Rating="{rating}"
+   tiff:Orientation="1"
+   crs:Version="12.0"
+   crs:WhiteBalance="Custom"
+   crs:Temperature="{temperature}"
+   crs:Tint="{tint}"
+   crs:Exposure2012="{exposure:+.2f}"
+   crs:Contrast2012="{contrast:+d}"
+   crs:Highlights2012="{highlights:+d}"
+   crs:Shadows2012="{shadows:+d}"
+   crs:Saturation="{saturation:+d}"
+   crs:HasCrop="{has_crop}"
+   crs:CropTop="{crop_top:.6f}"
+   crs:CropLeft="{crop_left:.6f}"
+   crs:CropBottom="{crop_bottom:.6f}"
+   crs:CropRight="{crop_right:.6f}"
+   crs:CropAngle="{crop_angle:.6f}">
+  </rdf:Description>
+ </rdf:RDF>
+</x:xmpmeta>
+"""
+
+# Size of every image, which is also the sensor size Exiv2 reports for it
+WIDTH, HEIGHT = 160, 120
+
+PP3_TEMPLATE = """[Version]
+AppVersion=5.8
+Version=346
+
+[Exposure]
+Auto=false
+Compensation=0
+
+[Sharpening]
+Enabled=true
+Radius=0.5
+"""
+
+
+def tiff_bytes(width, height, pixels, orientation=1):
+    """Uncompressed 8-bit RGB TIFF with the pixels, padded by the caller if need be."""
+    entries = [
+        (256, 4, 1, width),  # ImageWidth
+        (257, 4, 1, height),  # ImageLength
+        (258, 3, 1, 8),  # BitsPerSample
+        (259, 3, 1, 1),  # Compression: none
+        (262, 3, 1, 2),  # PhotometricInterpretation: RGB
+        (273, 4, 1, 0),  # StripOffsets, patched below
+        (274, 3, 1, orientation),  # Orientation
+        (277, 3, 1, 3),  # SamplesPerPixel
+        (278, 4, 1, height),  # RowsPerStrip
+        (279, 4, 1, len(pixels)),  # StripByteCounts
+        (284, 3, 1, 1),  # PlanarConfiguration: chunky
+    ]
+    ifd_offset = 8
+    data_offset = ifd_offset + 2 + 12 * len(entries) + 4
+    ifd = struct.pack("<H", len(entries))
+    for tag, kind, count, value in entries:
+        if tag == 273:
+            value = data_offset
+        if kind == 3:
+            ifd += struct.pack("<HHIHH", tag, kind, count, value, 0)
+        else:
+            ifd += struct.pack("<HHII", tag, kind, count, value)
+    ifd += struct.pack("<I", 0)
+    return b"II*\0" + struct.pack("<I", ifd_offset) + ifd + pixels
+
+
+def gradient(width, height, seed):
+    row = bytes((x * 256 // (3 * width) + seed) % 256 for x in range(3 * width))
+    return row * height
+
+
+def write_image(path, raw_bytes, rng):
+    pixels = gradient(WIDTH, HEIGHT, rng.randrange(256))
+    data = tiff_bytes(WIDTH, HEIGHT, pixels, orientation=rng.choice([1, 1, 1, 6, 8]))
+    with open(path, "wb") as f:
+        f.write(data)
+        # A raw's worth of sensor data that nothing reads, as a hole
+        f.truncate(max(raw_bytes, len(data)))
+
+
+def sidecar(rng):
+    has_crop = rng.random() < 0.4
+    top, left = (rng.uniform(0, 0.2), rng.uniform(0, 0.2)) if has_crop else (0, 0)
+    return XMP_TEMPLATE.format(
+        rating=rng.randrange(6),
+        temperature=rng.randrange(2800, 9000, 50),
+        tint=rng.randrange(-30, 31),
+        exposure=rng.uniform(-2, 2),
+        contrast=rng.randrange(-50, 51),
+        highlights=rng.randrange(-100, 1),
+        shadows=rng.randrange(0, 101),
+        saturation=rng.randrange(-30, 31),
+        has_crop="True" if has_crop else "False",
+        crop_top=top,
+        crop_left=left,
+        crop_bottom=1 - top / 2,
+        crop_right=1 - left / 2,
+        crop_angle=rng.uniform(-3, 3) if has_crop else 0,
+    )
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("directory")
+    parser.add_argument("--images", type=int, default=600)
+    parser.add_argument("--raw-mib", type=int, default=24, help="apparent size of each raw")
+    parser.add_argument("--per-directory", type=int, default=40)
+    parser.add_argument("--targets", type=int, default=24, help="images paired with a target for match_dev")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    manifest = []
+    for n in range(args.images):
+        directory = os.path.join(args.directory, "%04d" % (n // args.per_directory // 5),
+                                 "day%02d" % (n // args.per_directory % 5))
+        os.makedirs(directory, exist_ok=True)
+        stem = os.path.join(directory, "IMG_%05d" % n)
+        write_image(stem + ".dng", args.raw_mib << 20, rng)
+        with open(stem + ".xmp", "w") as f:
+            f.write(sidecar(rng))
+        if n % 3 == 0:
+            with open(stem + ".dng.pp3", "w") as f:
+                f.write(PP3_TEMPLATE)
+        if n % 4 == 0:
+            with open(stem + ".jpg", "wb") as f:
+                f.write(b"\xff\xd8\xff\xe0" + bytes(rng.randrange(256) for _ in range(2048)))
+        if n < args.targets:
+            target = stem + ".target.tif"
+            with open(target, "wb") as f:
+                f.write(tiff_bytes(WIDTH, HEIGHT, gradient(WIDTH, HEIGHT, rng.randrange(256))))
+            manifest.append("%s\t%s\n" % (os.path.relpath(stem + ".dng", args.directory),
+                                          os.path.relpath(target, args.directory)))
+    with open(os.path.join(args.directory, "Thumbs.db"), "wb") as f:
+        f.write(bytes(512))
+    # What the stand-in rawtherapee-cli "renders"
+    with open(os.path.join(args.directory, "render.tif"), "wb") as f:
+        f.write(tiff_bytes(WIDTH, HEIGHT, gradient(WIDTH, HEIGHT, 0)))
+    with open(os.path.join(args.directory, "manifest.tsv"), "w") as f:
+        f.writelines(manifest)
+
+
+if __name__ == "__main__":
+    main()
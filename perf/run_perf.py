@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""End-to-end performance check of lr2rt and match_dev against perf/baseline.json.
+
+Regenerates the corpus (see make_corpus.py), then runs each tool cold, with the corpus evicted from the page cache and
+no metadata cache, and warm, right after. Each run records files/s over its whole wall time, peak RSS, and for lr2rt the
+bytes of profiles written. match_dev renders through the stand-in rawtherapee-cli next to this script.
+
+A run fails when it is slower or bigger than its baseline by more than the tolerance, writes a different amount, or
+has no baseline to compare with; the script then exits with status 1. Record the baseline on the reference machine,
+with a release build, using --update-baseline and commit the result.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def evict(directory):
+    """Drops the corpus from the page cache, which needs no privileges for files we can open."""
+    if not hasattr(os, "posix_fadvise"):
+        return
+    for root, _, files in os.walk(directory):
+        for name in files:
+            fd = os.open(os.path.join(root, name), os.O_RDONLY)
+            try:
+                os.fsync(fd)
+                os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+            except OSError:
+                pass
+            finally:
+                os.close(fd)
+
+
+def measure(command, env=None):
+    """Runs the command, returning its wall time in seconds and peak RSS in MiB."""
+    start = time.monotonic()
+    process = subprocess.Popen(command, env=env, stdout=subprocess.DEVNULL)
+    _, status, usage = os.wait4(process.pid, 0)
+    wall = time.monotonic() - start
+    process.returncode = os.waitstatus_to_exitcode(status)
+    if process.returncode != 0:
+        raise SystemExit("%s exited with status %d" % (command[0], process.returncode))
+    # ru_maxrss is in KiB on Linux and in bytes on macOS
+    rss = usage.ru_maxrss / (1 << 20 if sys.platform == "darwin" else 1 << 10)
+    return wall, rss
+
+
+def run_lr2rt(args, corpus, name):
+    stats_path = os.path.join(args.work, name + ".json")
+    wall, rss = measure([args.lr2rt, "--quiet", "--jobs", str(args.jobs), "--cache", os.path.join(args.work, "cache"),
+                         "--stats-json", stats_path, corpus])
+    with open(stats_path) as f:
+        stats = json.load(f)
+    files = stats["stages"]["prefetch"]["files"]
+    return {"files_per_second": files / wall, "peak_rss_mib": rss, "bytes_written": stats["bytes_written"]}
+
+
+def run_match_dev(args, corpus, name):
+    env = dict(os.environ, PATH=HERE + os.pathsep + os.environ.get("PATH", ""),
+               LR2RT_PERF_RENDER=os.path.join(corpus, "render.tif"))
+    json_path = os.path.join(args.work, name + ".json")
+    wall, rss = measure([args.match_dev, "--batch", os.path.join(corpus, "manifest.tsv"), "--jobs", str(args.jobs),
+                         "--json", json_path], env=env)
+    with open(json_path) as f:
+        aggregate = json.load(f)["aggregate"]
+    if aggregate["failed"]:
+        raise SystemExit("match_dev couldn't evaluate %d images" % aggregate["failed"])
+    return {"files_per_second": aggregate["count"] / wall, "peak_rss_mib": rss}
+
+
+def regressions(name, measured, baseline, tolerance):
+    for metric, value in sorted(measured.items()):
+        expected = baseline.get(metric)
+        limit = tolerance[metric]
+        if expected is None:
+            verdict = "NO BASELINE"
+        elif metric == "files_per_second":
+            verdict = "REGRESSED" if value < expected * (1 - limit) else "ok"
+        elif metric == "peak_rss_mib":
+            verdict = "REGRESSED" if value > expected * (1 + limit) else "ok"
+        else:
+            verdict = "CHANGED" if abs(value - expected) > expected * limit else "ok"
+        print("  %-16s %-18s %12.1f  baseline %12s  %s" % (name, metric, value, expected, verdict))
+        if verdict != "ok":
+            yield "%s %s" % (name, metric)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--lr2rt", required=True)
+    parser.add_argument("--match-dev")
+    parser.add_argument("--work", required=True, help="scratch directory for the corpus and results")
+    parser.add_argument("--baseline", default=os.path.join(HERE, "baseline.json"))
+    parser.add_argument("--jobs", type=int, default=0)
+    parser.add_argument("--update-baseline", action="store_true", help="write the measured figures to the baseline")
+    args = parser.parse_args()
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    shutil.rmtree(args.work, ignore_errors=True)
+    os.makedirs(args.work)
+    corpus = os.path.join(args.work, "corpus")
+    subprocess.check_call([sys.executable, os.path.join(HERE, "make_corpus.py"), corpus] + baseline["corpus"])
+
+    results = {}
+    evict(corpus)
+    results["lr2rt_cold"] = run_lr2rt(args, corpus, "lr2rt_cold")
+    results["lr2rt_warm"] = run_lr2rt(args, corpus, "lr2rt_warm")
+    if args.match_dev:
+        evict(corpus)
+        results["match_dev_cold"] = run_match_dev(args, corpus, "match_dev_cold")
+        results["match_dev_warm"] = run_match_dev(args, corpus, "match_dev_warm")
+    with open(os.path.join(args.work, "results.json"), "w") as f:
+        json.dump(results, f, indent=2)
+
+    if args.update_baseline:
+        for name, measured in results.items():
+            baseline["runs"][name] = {metric: round(value, 1) for metric, value in measured.items()}
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2)
+            f.write("\n")
+        print("Updated %s" % args.baseline)
+        return 0
+
+    failures = []
+    for name, measured in results.items():
+        failures += regressions(name, measured, baseline["runs"].get(name, {}), baseline["tolerance"])
+    if failures:
+        print("Performance regressions: " + ", ".join(failures))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
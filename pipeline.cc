@@ -0,0 +1,484 @@
+#include "pipeline.h"
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <boost/filesystem/fstream.hpp>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "log.h"
+#include "lr2rt.h"
+#include "memory_budget.h"
+#include "metadata.h"
+#include "metadata_cache.h"
+#include "mmap_io.h"
+#include "settings.h"
+#include "xmp_sidecar.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct work_item_t {
+    boost::filesystem::path path;
+    std::unique_ptr<metadata_t> metadata;
+    settings_t settings;
+    // The memory the item is estimated to take, held until its profile is written; only held_memory of it is left
+    // once it has been parsed
+    memory_budget_t::reservation_t reservation;
+    std::size_t held_memory = 0;
+    // Unless the directory listing said otherwise
+    bool has_xmp_sidecar = true;
+    bool has_pp3 = true;
+};
+
+struct stage_stats_t {
+    explicit stage_stats_t(char const* name) : name{name} {}
+
+    char const* name;
+    std::atomic<std::size_t> items{0};
+    std::atomic<std::int64_t> busy_ns{0};
+
+    friend std::ostream& operator<<(std::ostream& s, stage_stats_t const& x) {
+        auto busy = x.busy_ns.load() / 1e9;
+        s << x.name << ": " << x.items << " files, " << busy << "s busy";
+        if (busy > 0) s << ", " << x.items / busy << " files/s per thread";
+        return s;
+    }
+};
+
+// What a stage did with a file, for its log record. Files moving on to the next stage are only logged as debug.
+struct outcome_t {
+    log_level_t level = log_level_t::debug;
+    char const* name = "done";
+    std::string detail;
+};
+
+class stage_timer_t {
+   public:
+    explicit stage_timer_t(stage_stats_t& stats) : stats_{stats}, start_{clock_type::now()} {}
+    ~stage_timer_t() {
+        stats_.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start_).count();
+    }
+
+   private:
+    stage_stats_t& stats_;
+    clock_type::time_point start_;
+};
+
+// Differential check of the fast XMP parser against Exiv2, with the time each took
+struct sidecar_verification_t {
+    std::atomic<std::size_t> count{0};
+    std::atomic<std::size_t> fallbacks{0};
+    std::atomic<std::size_t> mismatches{0};
+    std::atomic<std::int64_t> fast_ns{0};
+    std::atomic<std::int64_t> exiv2_ns{0};
+
+    void check(boost::filesystem::path const& sidecar_path) {
+        boost::filesystem::ifstream i{sidecar_path, std::ios::binary};
+        std::string packet{std::istreambuf_iterator<char>{i}, std::istreambuf_iterator<char>{}};
+        auto start = clock_type::now();
+        auto fast = parse_xmp_fast(packet);
+        auto fast_elapsed = clock_type::now() - start;
+        metadata_record_t expected;
+        start = clock_type::now();
+        try {
+            expected.sidecar = parse_xmp_exiv2(packet);
+        } catch (Exiv2::AnyError const& e) {
+            log_message(log_level_t::warning, "Exiv2 couldn't parse ", sidecar_path, ": ", e.what());
+            return;
+        }
+        auto exiv2_elapsed = clock_type::now() - start;
+        ++count;
+        if (!fast) {
+            ++fallbacks;
+            return;
+        }
+        fast_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(fast_elapsed).count();
+        exiv2_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(exiv2_elapsed).count();
+        metadata_record_t actual;
+        actual.sidecar = std::move(*fast);
+        auto differences = record_differences(expected, actual);
+        if (differences.empty()) return;
+        ++mismatches;
+        std::ostringstream o;
+        o << "Fast XMP parser disagrees with Exiv2 on " << sidecar_path << ":";
+        for (auto&& difference : differences) o << std::endl << "  " << difference;
+        log_string(log_level_t::warning, o.str());
+    }
+
+    friend std::ostream& operator<<(std::ostream& s, sidecar_verification_t const& x) {
+        s << "Verified " << x.count << " sidecars, " << x.mismatches << " mismatched, " << x.fallbacks
+          << " needed Exiv2";
+        auto parsed = x.count - x.fallbacks;
+        if (parsed && x.fast_ns) {
+            s << "; fast path " << x.fast_ns / 1e3 / parsed << "us/sidecar, Exiv2 " << x.exiv2_ns / 1e3 / parsed
+              << "us/sidecar (" << double(x.exiv2_ns) / x.fast_ns << "x)";
+        }
+        return s;
+    }
+};
+
+// XMP sidecars and RawTherapee profiles sit next to the images but aren't images themselves
+bool is_sidecar(boost::filesystem::path const& path) {
+    auto extension = path.extension().string();
+    return boost::iequals(extension, ".xmp") || boost::iequals(extension, ".pp3");
+}
+
+void advise_willneed(boost::filesystem::path const& path, off_t length) {
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+#ifdef POSIX_FADV_WILLNEED
+    ::posix_fadvise(fd, 0, length, POSIX_FADV_WILLNEED);
+#endif
+    ::close(fd);
+}
+
+// Peak resident set size of the process so far, in bytes
+std::size_t peak_rss() {
+    rusage usage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+#if TARGET_OS_IS_APPLE
+    return usage.ru_maxrss;
+#else
+    return std::size_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+}  // namespace
+
+struct pipeline_t::impl_t {
+    explicit impl_t(pipeline_options_t const& options)
+        : options{options},
+          jobs{options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency())},
+          submitted{4 * jobs},
+          prefetched{4 * jobs},
+          parsed{2 * jobs},
+          converted{4 * jobs},
+          memory_budget{options.memory_budget_mb << 20},
+          start{clock_type::now()} {
+        spawn(jobs, prefetch_stats, submitted, prefetched, [](work_item_t item, outcome_t&) {
+            if (!item.metadata) {
+                advise_willneed(item.path, header_window);
+                if (item.has_xmp_sidecar) advise_willneed(xmp_sidecar_path(item.path), 0);
+            }
+            if (item.has_pp3) advise_willneed(pp3_path(item.path), 0);
+            return std::optional<work_item_t>{std::move(item)};
+        });
+        initialize_xmp_toolkit();
+        if (!options.cache_path.empty()) cache = std::make_unique<metadata_cache_t>(options.cache_path);
+        spawn(jobs, parse_stats, prefetched, parsed, [this](work_item_t item, outcome_t& outcome) {
+            if (item.metadata) {
+                if (!add_image_metadata(item)) {
+                    outcome = {log_level_t::warning, "unreadable", "couldn't read the image to crop it"};
+                    return std::optional<work_item_t>{};
+                }
+                item.reservation.shrink_to(item.held_memory);
+                item.settings.load(item.path);
+                outcome.name = "read";
+                return std::optional<work_item_t>{std::move(item)};
+            }
+            item.metadata = load_metadata(item.path, item.has_xmp_sidecar);
+            item.reservation.shrink_to(item.held_memory);
+            if (!item.metadata) {
+                outcome = {log_level_t::warning, "unreadable", "Exiv2 couldn't read it"};
+                return std::optional<work_item_t>{};
+            }
+            if (!item.metadata->is_lightroom() && !this->options.force) {
+                outcome = {log_level_t::info, "skipped", "doesn't appear to be a Lightroom file"};
+                return std::optional<work_item_t>{};
+            }
+            if (this->options.verify_sidecars && item.has_xmp_sidecar) {
+                auto sidecar_path = xmp_sidecar_path(item.path);
+                if (boost::filesystem::is_regular_file(sidecar_path)) sidecar_verification.check(sidecar_path);
+            }
+            if (item.has_pp3) item.settings.load(item.path);
+            outcome.name = item.metadata->record().sidecar.empty() ? "read" : "read with sidecar";
+            return std::optional<work_item_t>{std::move(item)};
+        });
+        spawn(jobs, convert_stats, parsed, converted, [](work_item_t item, outcome_t& outcome) {
+            import_all(*item.metadata, item.settings);
+            item.metadata.reset();
+            if (item.settings.empty()) {
+                outcome.name = "nothing to import";
+                return std::optional<work_item_t>{};
+            }
+            outcome.name = "converted";
+            return std::optional<work_item_t>{std::move(item)};
+        });
+        writer = std::thread{[this] { write(); }};
+    }
+
+    // Runs `count` workers that apply f to every item of `in`, forwarding non-empty results to `out` and logging what
+    // f said it did. `out` is closed once the last worker is done.
+    template <typename TIn, typename TOut, typename F>
+    void spawn(unsigned count, stage_stats_t& stats, bounded_queue<TIn>& in, bounded_queue<TOut>& out, F f) {
+        auto remaining = std::make_shared<std::atomic<unsigned>>(count);
+        for (unsigned n = 0; n < count; ++n) {
+            threads.emplace_back([&stats, &in, &out, f, remaining] {
+                while (auto item = in.pop()) {
+                    auto path = item_path(*item);
+                    auto start = clock_type::now();
+                    std::optional<TOut> result;
+                    outcome_t outcome;
+                    try {
+                        stage_timer_t timer{stats};
+                        result = f(std::move(*item), outcome);
+                        ++stats.items;
+                    } catch (std::exception const& e) {
+                        outcome = {log_level_t::error, "failed", e.what()};
+                    }
+                    log_file(outcome.level, path, stats.name, outcome.name, clock_type::now() - start,
+                             std::move(outcome.detail));
+                    if (result) out.push(std::move(*result));
+                }
+                if (--*remaining == 0) out.close();
+            });
+        }
+    }
+
+    std::unique_ptr<metadata_t> load_live_metadata(boost::filesystem::path const& path, bool has_sidecar = true) {
+        try {
+            return std::make_unique<metadata_t>(path, has_sidecar);
+        } catch (Exiv2::AnyError const&) {
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<metadata_t> load_metadata(boost::filesystem::path const& path, bool has_sidecar = true) {
+        if (!cache) return load_live_metadata(path, has_sidecar);
+        if (auto record = cache->find(path)) {
+            ++cache_hits;
+            if (options.verify_cache) verify(path, *record);
+            return std::make_unique<metadata_t>(std::move(*record));
+        }
+        ++cache_misses;
+        auto metadata = load_live_metadata(path, has_sidecar);
+        if (metadata) cache->insert(path, metadata->record());
+        return metadata;
+    }
+
+    // Metadata submitted with an image (from a catalog) lacks what only the image itself has: the camera's
+    // orientation and the sensor size. Cropping is the one import that needs them, so only cropped images are read.
+    bool add_image_metadata(work_item_t& item) {
+        if (!item.metadata->get<bool>("Xmp.crs.HasCrop").value_or(false)) return true;
+        auto image = load_metadata(item.path);
+        if (!image) return false;
+        auto record = item.metadata->record();
+        auto image_record = image->record();
+        record.width = image_record.width;
+        record.height = image_record.height;
+        record.image = std::move(image_record.image);
+        item.metadata = std::make_unique<metadata_t>(std::move(record));
+        return true;
+    }
+
+    void verify(boost::filesystem::path const& path, metadata_record_t const& cached) {
+        auto live = load_live_metadata(path);
+        auto differences = live ? record_differences(live->record(), cached)
+                                : std::vector<std::string>{"no longer readable by Exiv2"};
+        if (differences.empty()) return;
+        ++cache_mismatches;
+        std::ostringstream o;
+        o << "Cached metadata for " << path << " differs from file:";
+        for (auto&& difference : differences) o << std::endl << "  " << difference;
+        log_string(log_level_t::warning, o.str());
+    }
+
+    // Estimated memory of an item from submission until its profile is written. While it is parsed: the header
+    // window of the mapping that Exiv2 reads the metadata from (see mmap_io_t) and the sidecar text, neither of which
+    // is touched when the metadata comes from the cache. From then on: the decoded metadata, taken to be as large as
+    // the sidecar, the settings read from an existing profile, and an allowance for the rest of the item. Nothing
+    // without a budget, so that no file is looked at.
+    struct item_memory_t {
+        std::size_t parsing = 0;
+        std::size_t held = 0;
+    };
+
+    item_memory_t item_memory(boost::filesystem::path const& path,
+                              bool read_image,
+                              bool has_xmp_sidecar = true,
+                              bool has_pp3 = true) const {
+        static constexpr std::size_t item_allowance = 16 << 10;
+        item_memory_t memory;
+        if (!options.memory_budget_mb) return memory;
+        auto cached = cache && !options.verify_cache && cache->contains(path);
+        boost::system::error_code ec;
+        if (read_image && !cached) {
+            auto size = boost::filesystem::file_size(path, ec);
+            memory.parsing = ec ? header_window : std::min<std::size_t>(size, header_window);
+        }
+        if (has_xmp_sidecar) {
+            auto size = boost::filesystem::file_size(xmp_sidecar_path(path), ec);
+            if (!ec) {
+                if (!cached) memory.parsing += size;
+                memory.held += size;
+            }
+        }
+        if (has_pp3) {
+            auto size = boost::filesystem::file_size(pp3_path(path), ec);
+            if (!ec) memory.held += size;
+        }
+        memory.held += item_allowance;
+        return memory;
+    }
+
+    memory_budget_t::reservation_t reserve(item_memory_t const& memory) {
+        return memory_budget.acquire(memory.parsing + memory.held);
+    }
+
+    // Profiles only hold what differs from the shared base profile
+    settings_t new_settings() const { return settings_t{options.base_profile}; }
+
+    static boost::filesystem::path const& item_path(work_item_t const& x) { return x.path; }
+
+    // Commits whatever profiles are ready in one go, in path order, so that writes to the same directory are grouped
+    void write() {
+        static constexpr std::size_t batch_size = 64;
+        std::vector<work_item_t> batch;
+        while (auto item = converted.pop()) {
+            batch.push_back(std::move(*item));
+            while (batch.size() < batch_size) {
+                auto next = converted.try_pop();
+                if (!next) break;
+                batch.push_back(std::move(*next));
+            }
+            std::sort(batch.begin(), batch.end(), [](auto&& a, auto&& b) { return a.path < b.path; });
+            for (auto&& x : batch) {
+                auto start = clock_type::now();
+                try {
+                    stage_timer_t timer{write_stats};
+                    bytes_written += x.settings.commit_by(x.path);
+                    x.reservation.release();
+                    ++write_stats.items;
+                    log_file(log_level_t::info, x.path, write_stats.name, "written", clock_type::now() - start);
+                } catch (std::exception const& e) {
+                    auto elapsed = clock_type::now() - start;
+                    log_file(log_level_t::error, x.path, write_stats.name, "failed", elapsed, e.what());
+                }
+            }
+            batch.clear();
+        }
+    }
+
+    void finish() {
+        if (finished) return;
+        finished = true;
+        submitted.close();
+        for (auto&& thread : threads) thread.join();
+        writer.join();
+        if (cache) {
+            try {
+                cache->save();
+            } catch (std::exception const& e) {
+                log_message(log_level_t::error, "Failed to save metadata cache: ", e.what());
+            }
+        }
+        if (options.verify_cache)
+            log_message(
+                log_level_t::info, "Verified ", cache_hits, " cached records, ", cache_mismatches, " mismatched");
+        if (options.verify_sidecars) log_message(log_level_t::info, sidecar_verification);
+        if (options.shard.count > 1) log_message(log_level_t::info, shard_summary);
+        if (options.memory_budget_mb)
+            log_message(log_level_t::info, "Peak RSS ", peak_rss() >> 20, " MiB; at most ", memory_budget.peak() >> 20,
+                        " MiB of ", options.memory_budget_mb, " MiB budget in flight");
+        else
+            log_message(log_level_t::info, "Peak RSS ", peak_rss() >> 20, " MiB");
+        if (options.stats && log_enabled(log_level_t::info)) {
+            auto wall = std::chrono::duration<double>(clock_type::now() - start).count();
+            std::ostringstream o;
+            o << "Pipeline finished in " << wall << "s with " << jobs << " jobs";
+            for (auto stats : {&prefetch_stats, &parse_stats, &convert_stats, &write_stats}) {
+                o << std::endl << "  " << *stats;
+                if (wall > 0) o << ", " << stats->items / wall << " files/s overall";
+            }
+            o << std::endl << "  image I/O: " << mmap_io_t::totals();
+            o << std::endl << "  sidecars: " << xmp_totals();
+            if (cache) o << std::endl << "  metadata cache: " << cache_hits << " hits, " << cache_misses << " misses";
+            log_string(log_level_t::info, o.str());
+        }
+        if (!options.stats_json_path.empty()) write_stats_json();
+    }
+
+    // The --stats numbers for tools, e.g. perf/run_perf.py
+    void write_stats_json() {
+        boost::filesystem::ofstream o{options.stats_json_path};
+        o << "{\n  \"wall_seconds\": " << std::chrono::duration<double>(clock_type::now() - start).count()
+          << ",\n  \"jobs\": " << jobs << ",\n  \"stages\": {";
+        char const* separator = "\n";
+        for (auto stats : {&prefetch_stats, &parse_stats, &convert_stats, &write_stats}) {
+            o << separator << "    \"" << stats->name << "\": {\"files\": " << stats->items
+              << ", \"busy_seconds\": " << stats->busy_ns / 1e9 << "}";
+            separator = ",\n";
+        }
+        o << "\n  },\n  \"files_written\": " << write_stats.items << ",\n  \"bytes_written\": " << bytes_written
+          << ",\n  \"peak_rss_bytes\": " << peak_rss() << ",\n  \"cache_hits\": " << cache_hits
+          << ",\n  \"cache_misses\": " << cache_misses << "\n}\n";
+        if (!o) log_message(log_level_t::error, "Failed to write stats to ", options.stats_json_path);
+    }
+
+    pipeline_options_t const options;
+    unsigned const jobs;
+    bounded_queue<work_item_t> submitted;
+    bounded_queue<work_item_t> prefetched;
+    bounded_queue<work_item_t> parsed;
+    bounded_queue<work_item_t> converted;
+    memory_budget_t memory_budget;
+    stage_stats_t prefetch_stats{"prefetch"};
+    stage_stats_t parse_stats{"parse"};
+    stage_stats_t convert_stats{"convert"};
+    stage_stats_t write_stats{"write"};
+    std::atomic<std::uint64_t> bytes_written{0};
+    std::unique_ptr<metadata_cache_t> cache;
+    std::atomic<std::size_t> cache_hits{0};
+    std::atomic<std::size_t> cache_misses{0};
+    std::atomic<std::size_t> cache_mismatches{0};
+    sidecar_verification_t sidecar_verification;
+    shard_summary_t shard_summary{options.shard};
+    std::vector<std::thread> threads;
+    std::thread writer;
+    clock_type::time_point const start;
+    bool finished = false;
+};
+
+pipeline_t::pipeline_t(pipeline_options_t const& options) : impl_{std::make_unique<impl_t>(options)} {}
+
+pipeline_t::~pipeline_t() { impl_->finish(); }
+
+void pipeline_t::submit(boost::filesystem::path path) {
+    if (is_sidecar(path) || !impl_->shard_summary.admit(path)) return;
+    auto memory = impl_->item_memory(path, true);
+    impl_->submitted.push(
+        work_item_t{std::move(path), nullptr, impl_->new_settings(), impl_->reserve(memory), memory.held});
+}
+
+void pipeline_t::submit(walked_image_t image) {
+    if (!impl_->shard_summary.admit(image.path)) return;
+    auto memory = impl_->item_memory(image.path, true, image.has_xmp_sidecar, image.has_pp3);
+    impl_->submitted.push(work_item_t{std::move(image.path),
+                                      nullptr,
+                                      impl_->new_settings(),
+                                      impl_->reserve(memory),
+                                      memory.held,
+                                      image.has_xmp_sidecar,
+                                      image.has_pp3});
+}
+
+void pipeline_t::submit(boost::filesystem::path path, metadata_record_t record) {
+    if (!impl_->shard_summary.admit(path)) return;
+    // Only cropped images are read (see add_image_metadata), and there's no sidecar to read
+    auto metadata = std::make_unique<metadata_t>(std::move(record));
+    auto cropped = metadata->get<bool>("Xmp.crs.HasCrop").value_or(false);
+    auto memory = impl_->item_memory(path, cropped, false);
+    impl_->submitted.push(work_item_t{
+        std::move(path), std::move(metadata), impl_->new_settings(), impl_->reserve(memory), memory.held});
+}
+
+void pipeline_t::finish() { impl_->finish(); }
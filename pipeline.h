@@ -0,0 +1,44 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <memory>
+
+#include "metadata.h"
+#include "settings.h"
+#include "shard.h"
+#include "walk.h"
+
+struct pipeline_options_t {
+    bool force = false;
+    unsigned jobs = 0;
+    bool stats = false;
+    boost::filesystem::path stats_json_path;
+    boost::filesystem::path cache_path;
+    bool verify_cache = false;
+    bool verify_sidecars = false;
+    std::size_t memory_budget_mb = 0;
+    shard_t shard;
+    // Profile that every written profile starts from, if any (see read_base_profile)
+    std::shared_ptr<profile_t const> base_profile;
+};
+
+// Staged import pipeline: prefetch -> parse -> convert -> write, connected by bounded queues so that blocking I/O in
+// one stage overlaps CPU work in the others. Files are submitted from any thread; those outside the configured shard
+// and sidecars are dropped on submission. With a memory budget, submit() blocks while the files still to be parsed
+// may need more than the budget. finish() drains all stages.
+class pipeline_t {
+   public:
+    explicit pipeline_t(pipeline_options_t const& options);
+    ~pipeline_t();
+
+    void submit(boost::filesystem::path path);
+    // Imports an image found by a directory walk, which already knows which of its sidecars exist
+    void submit(walked_image_t image);
+    // Imports an image whose Lightroom metadata is already known, e.g. from a catalog, instead of reading its sidecar
+    void submit(boost::filesystem::path path, metadata_record_t record);
+    void finish();
+
+   private:
+    struct impl_t;
+    std::unique_ptr<impl_t> impl_;
+};
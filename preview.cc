@@ -0,0 +1,98 @@
+#include "preview.h"
+
+#include <algorithm>
+#include <cassert>
+#include <csetjmp>
+#include <cstddef>
+#include <cstdio>  // jpeglib.h expects FILE to be declared
+#include <jpeglib.h>
+#include <stdexcept>
+
+#include "mmap_io.h"
+#include "xmp_sidecar.h"
+
+namespace {
+
+struct jpeg_error_t {
+    jpeg_error_mgr manager;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+void error_exit(j_common_ptr info) {
+    auto error = reinterpret_cast<jpeg_error_t*>(info->err);
+    (*info->err->format_message)(info, error->message);
+    std::longjmp(error->jump, 1);
+}
+
+// libjpeg reports errors by longjmp-ing out of here, so nothing in this frame may need destroying. Returns false with
+// error.message set if the JPEG couldn't be decoded.
+bool decode_jpeg(Exiv2::byte const* data,
+                 std::size_t size,
+                 unsigned scale_denom,
+                 cimg_library::CImg<uint8_t>& image,
+                 jpeg_error_t& error) {
+    jpeg_decompress_struct info;
+    info.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = error_exit;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, data, size);
+    jpeg_read_header(&info, TRUE);
+    info.out_color_space = JCS_RGB;
+    info.scale_num = 1;
+    info.scale_denom = scale_denom;
+    jpeg_start_decompress(&info);
+    image.assign(info.output_width, info.output_height, 1, 3);
+    auto row = (*info.mem->alloc_sarray)(reinterpret_cast<j_common_ptr>(&info), JPOOL_IMAGE, 3 * info.output_width, 1);
+    while (info.output_scanline < info.output_height) {
+        auto y = info.output_scanline;
+        jpeg_read_scanlines(&info, row, 1);
+        // CImg keeps each channel in its own plane
+        for (unsigned x = 0; x < info.output_width; ++x) {
+            image(x, y, 0, 0) = row[0][3 * x];
+            image(x, y, 0, 1) = row[0][3 * x + 1];
+            image(x, y, 0, 2) = row[0][3 * x + 2];
+        }
+    }
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+}  // namespace
+
+cimg_library::CImg<uint8_t> read_preview(boost::filesystem::path const& image_path, unsigned scale_denom) {
+    if (scale_denom != 1 && scale_denom != 2 && scale_denom != 4 && scale_denom != 8)
+        throw std::invalid_argument{"preview scale must be 1, 2, 4 or 8"};
+    // Reading the image's metadata may parse XMP, which has to be set up once before using it from several threads
+    initialize_xmp_toolkit();
+    auto image = Exiv2::ImageFactory::open(Exiv2::BasicIo::AutoPtr{new mmap_io_t{image_path}});
+    assert(image.get());
+    image->readMetadata();
+    Exiv2::PreviewManager previews{*image};
+    // Ordered from smallest to largest
+    auto properties = previews.getPreviewProperties();
+    auto largest = std::find_if(properties.rbegin(), properties.rend(),
+                                [](Exiv2::PreviewProperties const& x) { return x.mimeType_ == "image/jpeg"; });
+    if (largest == properties.rend()) throw std::runtime_error{"No JPEG preview in " + image_path.string()};
+    // Only the preview's bytes are read, into memory
+    auto preview = previews.getPreviewImage(*largest);
+    cimg_library::CImg<uint8_t> result;
+    jpeg_error_t error;
+    if (!decode_jpeg(preview.pData(), preview.size(), scale_denom, result, error))
+        throw std::runtime_error{"Couldn't decode the preview in " + image_path.string() + ": " + error.message};
+    return result;
+}
+
+void match_preview_size(cimg_library::CImg<uint8_t>& rendered, cimg_library::CImg<uint8_t> const& preview) {
+    auto width = preview.width();
+    auto height = preview.height();
+    if ((rendered.width() > rendered.height()) != (width > height)) std::swap(width, height);
+    if (rendered.width() == width && rendered.height() == height) return;
+    // Moving average, since this nearly always scales down
+    rendered.resize(width, height, 1, 3, 2);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <CImg.h>
+#include <boost/filesystem.hpp>
+
+// Decodes the largest JPEG preview embedded in an image, e.g. the full-size one Lightroom keeps up to date in DNGs it
+// has written, straight from the file into memory. The JPEG is decoded at 1/scale_denom of its size, which libjpeg
+// does for little more than the cost of entropy decoding; scale_denom must be 1, 2, 4 or 8.
+cimg_library::CImg<uint8_t> read_preview(boost::filesystem::path const& image_path, unsigned scale_denom = 1);
+
+// Resizes a rendering to the pixel count of a preview, so that their histograms compare. Previews may be stored
+// unrotated, so the rendering keeps its own orientation.
+void match_preview_size(cimg_library::CImg<uint8_t>& rendered, cimg_library::CImg<uint8_t> const& preview);
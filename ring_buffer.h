@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Fixed-capacity lock-free multi-producer/single-consumer queue (Vyukov's bounded queue). Each slot carries a sequence
+// number that tells producers and the consumer whose turn it is, so neither side ever takes a lock; try_push() fails
+// instead of blocking when the queue is full. The capacity is rounded up to a power of two.
+template <typename T>
+class ring_buffer {
+   public:
+    explicit ring_buffer(std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity) size *= 2;
+        mask_ = size - 1;
+        slots_ = std::make_unique<slot_t[]>(size);
+        for (std::size_t n = 0; n < size; ++n) slots_[n].sequence.store(n, std::memory_order_relaxed);
+    }
+
+    // Moves from `value` only on success
+    bool try_push(T& value) {
+        auto position = head_.load(std::memory_order_relaxed);
+        while (true) {
+            auto& slot = slots_[position & mask_];
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+            if (difference == 0) {
+                if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only ever called from the one consumer thread
+    bool try_pop(T& value) {
+        auto& slot = slots_[tail_ & mask_];
+        auto sequence = slot.sequence.load(std::memory_order_acquire);
+        if (static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(tail_ + 1) < 0) return false;
+        value = std::move(slot.value);
+        slot.sequence.store(tail_ + mask_ + 1, std::memory_order_release);
+        ++tail_;
+        return true;
+    }
+
+    // Whether try_pop() would succeed. Only ever called from the one consumer thread.
+    [[nodiscard]] bool ready() const {
+        auto sequence = slots_[tail_ & mask_].sequence.load(std::memory_order_acquire);
+        return static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(tail_ + 1) >= 0;
+    }
+
+    // Number of items pushed so far
+    [[nodiscard]] std::size_t pushed() const { return head_.load(std::memory_order_acquire); }
+
+   private:
+    struct slot_t {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<slot_t[]> slots_;
+    std::size_t mask_ = 0;
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::size_t tail_ = 0;
+};
@@ -0,0 +1,142 @@
+#include "run.h"
+
+#include <algorithm>
+#include <boost/filesystem/fstream.hpp>
+#include <functional>
+#include <iostream>
+
+#include "catalog.h"
+#include "log.h"
+#include "pipeline.h"
+#include "serve.h"
+#include "walk.h"
+#include "watch.h"
+
+namespace {
+
+// Submits a file as it is, or the images below a directory
+void process_input(boost::filesystem::path const& path, walk_options_t const& walk_options, pipeline_t& pipeline) {
+    if (boost::filesystem::is_directory(path))
+        walk_images(path, walk_options, [&](walked_image_t image) { pipeline.submit(std::move(image)); });
+    else
+        pipeline.submit(path);
+}
+
+std::optional<boost::filesystem::path> find_input(std::string const& input) {
+    try {
+        return boost::filesystem::canonical(input);
+    } catch (boost::filesystem::filesystem_error const& e) {
+        log_message(log_level_t::error, "Couldn't find ", input, ": ", e.what());
+        return std::nullopt;
+    }
+}
+
+// Calls f with each path listed in the file (- for stdin) as it is read, so that a producer like find can stream
+void read_file_list(std::string const& list, bool null_separated, std::function<void(std::string const&)> const& f) {
+    boost::filesystem::ifstream file;
+    if (list != "-") {
+        file.open(list, std::ios::binary);
+        if (!file.is_open()) {
+            log_message(log_level_t::error, "Couldn't open file list ", list);
+            return;
+        }
+    }
+    std::istream& i = list == "-" ? std::cin : file;
+    std::string line;
+    while (std::getline(i, line, null_separated ? '\0' : '\n')) {
+        if (!line.empty()) f(line);
+    }
+}
+
+bool is_within(boost::filesystem::path const& path, boost::filesystem::path const& directory) {
+    auto [d, p] = std::mismatch(directory.begin(), directory.end(), path.begin(), path.end());
+    return d == directory.end();
+}
+
+// Submits the catalog's images, limited to those under `paths` if there are any
+// Throws if the catalog can't be read
+void process_catalog(boost::filesystem::path const& catalog,
+                     std::vector<boost::filesystem::path> const& paths,
+                     pipeline_t& pipeline) {
+    std::size_t count = 0;
+    read_catalog(catalog, [&](catalog_image_t image) {
+        auto selected = std::any_of(paths.begin(), paths.end(), [&](auto&& x) { return is_within(image.path, x); });
+        if (!paths.empty() && !selected) return;
+        if (!boost::filesystem::is_regular_file(image.path)) {
+            log_message(log_level_t::warning, "Couldn't find ", image.path, " from the catalog; skipping");
+            return;
+        }
+        pipeline.submit(std::move(image.path), std::move(image.record));
+        ++count;
+    });
+    log_message(log_level_t::info, "Read ", count, " images from catalog ", catalog);
+}
+
+}  // namespace
+
+int run(run_options_t const& options) {
+    configure_log(options.log);
+    // Parsed once here and shared, read-only, by every profile written
+    auto pipeline_options = options.pipeline;
+    if (!options.base_profile.empty()) {
+        try {
+            pipeline_options.base_profile = read_base_profile(options.base_profile);
+        } catch (std::exception const& e) {
+            log_message(log_level_t::error, "Couldn't read base profile: ", e.what());
+            return 1;
+        }
+    }
+    if (!options.serve.empty())
+        return serve({options.serve, {options.pipeline.force, options.pipeline.jobs, pipeline_options.base_profile}});
+
+    std::vector<boost::filesystem::path> paths;
+    for (auto&& input : options.inputs) {
+        if (auto path = find_input(input)) paths.push_back(std::move(*path));
+    }
+
+    walk_options_t walk_options{options.extensions, options.pipeline.jobs};
+    // Watches go up before the initial import so that edits made while it runs aren't lost
+    std::unique_ptr<watcher_t> watcher;
+    if (options.watch) {
+        std::vector<boost::filesystem::path> directories;
+        for (auto&& path : paths) {
+            if (boost::filesystem::is_directory(path))
+                directories.push_back(path);
+            else
+                log_message(log_level_t::warning, "Not watching ", path, ": only directories can be watched");
+        }
+        try {
+            watcher = std::make_unique<watcher_t>(directories, walk_options,
+                                                  std::chrono::milliseconds{options.debounce_ms});
+        } catch (std::exception const& e) {
+            log_message(log_level_t::error, "Couldn't watch input directories: ", e.what());
+            return 1;
+        }
+    }
+
+    pipeline_t pipeline{pipeline_options};
+    if (!options.catalog.empty()) {
+        if (!options.files_from.empty()) {
+            read_file_list(options.files_from, options.null_separated, [&](std::string const& input) {
+                if (auto path = find_input(input)) paths.push_back(std::move(*path));
+            });
+        }
+        try {
+            process_catalog(options.catalog, paths, pipeline);
+        } catch (std::exception const& e) {
+            log_message(log_level_t::error, "Couldn't import catalog ", options.catalog, ": ", e.what());
+            // What was submitted before the error is still written as the pipeline is destroyed
+            return 1;
+        }
+    } else {
+        for (auto&& path : paths) process_input(path, walk_options, pipeline);
+        if (!options.files_from.empty()) {
+            read_file_list(options.files_from, options.null_separated, [&](std::string const& input) {
+                if (auto path = find_input(input)) process_input(*path, walk_options, pipeline);
+            });
+        }
+    }
+    if (watcher) watcher->run(pipeline);
+    pipeline.finish();
+    return 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "log.h"
+#include "pipeline.h"
+#include "walk.h"
+
+// What the lr2rt command line asks for
+struct run_options_t {
+    std::vector<std::string> inputs;
+    std::string files_from;
+    bool null_separated = false;
+    std::set<std::string> extensions = parse_extensions(default_raw_extensions);  // of images found in directories
+    boost::filesystem::path catalog;
+    pipeline_options_t pipeline;
+    bool watch = false;
+    unsigned debounce_ms = 100;
+    std::string serve;
+    boost::filesystem::path base_profile;
+    log_options_t log;
+};
+
+// Imports the inputs, the file list and the catalog, then keeps watching if asked to, or serves import requests
+// instead; returns the exit status
+int run(run_options_t const& options);
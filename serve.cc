@@ -0,0 +1,314 @@
+#include "serve.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#include "json.h"
+#include "log.h"
+#include "stop_signal.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+std::string decode_base64(std::string const& x) {
+    static auto const values = [] {
+        std::array<signed char, 256> values{};
+        values.fill(-1);
+        char const alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int n = 0; n < 64; ++n) values[static_cast<unsigned char>(alphabet[n])] = n;
+        return values;
+    }();
+    std::string result;
+    result.reserve(x.size() / 4 * 3);
+    std::uint32_t buffer = 0;
+    int bits = 0;
+    for (unsigned char c : x) {
+        if (c == '=') break;
+        if (std::isspace(c)) continue;
+        auto value = values[c];
+        if (value < 0) throw std::invalid_argument{"invalid base64"};
+        buffer = buffer << 6 | value;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            result += static_cast<char>(buffer >> bits & 0xff);
+        }
+    }
+    return result;
+}
+
+char const* status_name(import_result_t::status_t status) {
+    switch (status) {
+        case import_result_t::status_t::imported:
+            return "imported";
+        case import_result_t::status_t::not_lightroom:
+            return "not_lightroom";
+        case import_result_t::status_t::nothing_to_import:
+            return "nothing_to_import";
+        case import_result_t::status_t::failed:
+            break;
+    }
+    return "failed";
+}
+
+std::string response(std::string const& id, import_result_t const& result, bool with_pp3, double latency_ms) {
+    std::ostringstream o;
+    o << "{\"id\": " << json_string(id) << ", \"status\": " << json_string(status_name(result.status));
+    if (with_pp3 && result.status == import_result_t::status_t::imported) o << ", \"pp3\": " << json_string(result.pp3);
+    if (!result.error.empty()) o << ", \"error\": " << json_string(result.error);
+    o << ", \"latency_ms\": " << latency_ms << "}\n";
+    return o.str();
+}
+
+// Latencies of every request served, for the summary at exit
+class latency_stats_t {
+   public:
+    void add(double ms) {
+        std::lock_guard lock{mutex_};
+        latencies_.push_back(ms);
+    }
+
+    friend std::ostream& operator<<(std::ostream& s, latency_stats_t const& x) {
+        std::vector<double> latencies;
+        {
+            std::lock_guard lock{x.mutex_};
+            latencies = x.latencies_;
+        }
+        s << "Served " << latencies.size() << " requests";
+        if (latencies.empty()) return s;
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) { return latencies[std::size_t(p * (latencies.size() - 1))]; };
+        return s << "; latency p50 " << percentile(0.5) << "ms, p90 " << percentile(0.9) << "ms, p99 "
+                 << percentile(0.99) << "ms, max " << latencies.back() << "ms";
+    }
+
+   private:
+    mutable std::mutex mutex_;
+    std::vector<double> latencies_;
+};
+
+// One client. Requests are read on a thread of its own; answers are written by the importer's workers as they
+// finish, so the connection lives on until the last of them is written.
+class connection_t {
+   public:
+    connection_t(int in, int out, bool owns_fds) : in_{in}, out_{out}, owns_fds_{owns_fds} {}
+    ~connection_t() {
+        if (owns_fds_) ::close(in_);
+    }
+    connection_t(connection_t const&) = delete;
+    connection_t& operator=(connection_t const&) = delete;
+
+    [[nodiscard]] int in() const { return in_; }
+
+    // Clients that go away just miss their answers (SIGPIPE is ignored while serving)
+    void write_line(std::string const& line) {
+        std::lock_guard lock{mutex_};
+        for (std::size_t written = 0; written < line.size();) {
+            auto n = ::write(out_, line.data() + written, line.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            written += n;
+        }
+    }
+
+   private:
+    int const in_;
+    int const out_;
+    bool const owns_fds_;
+    std::mutex mutex_;
+};
+
+class server_t {
+   public:
+    explicit server_t(importer_options_t const& options) : importer_{options} {}
+
+    // Reads requests from the connection until it ends or stop_fd becomes readable
+    void serve_connection(std::shared_ptr<connection_t> const& connection, int stop_fd) {
+        std::string buffer;
+        char chunk[64 * 1024];
+        pollfd fds[] = {{connection->in(), POLLIN, 0}, {stop_fd, POLLIN, 0}};
+        while (true) {
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[1].revents & POLLIN) break;
+            auto n = ::read(connection->in(), chunk, sizeof chunk);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            buffer.append(chunk, n);
+            std::size_t start = 0;
+            for (auto end = buffer.find('\n'); end != std::string::npos; end = buffer.find('\n', start)) {
+                handle(buffer.substr(start, end - start), connection);
+                start = end + 1;
+            }
+            buffer.erase(0, start);
+        }
+        handle(buffer, connection);
+    }
+
+    // Serves a socket client on a detached thread
+    void serve_client(int fd, int stop_fd) {
+        auto connection = std::make_shared<connection_t>(fd, fd, true);
+        {
+            std::lock_guard lock{mutex_};
+            ++readers_;
+        }
+        std::thread{[this, connection, stop_fd] {
+            serve_connection(connection, stop_fd);
+            std::lock_guard lock{mutex_};
+            --readers_;
+            idle_.notify_all();
+        }}.detach();
+    }
+
+    // Waits until every client has stopped sending and every request has been answered
+    void wait_idle() {
+        std::unique_lock lock{mutex_};
+        idle_.wait(lock, [&] { return readers_ == 0 && outstanding_ == 0; });
+    }
+
+    latency_stats_t const& latencies() const { return latencies_; }
+
+   private:
+    void handle(std::string const& line, std::shared_ptr<connection_t> const& connection) {
+        if (std::all_of(line.begin(), line.end(), [](unsigned char c) { return std::isspace(c); })) return;
+        auto start = clock_type::now();
+        std::string id;
+        std::optional<boost::filesystem::path> path;
+        import_request_t request;
+        try {
+            boost::property_tree::ptree json;
+            std::istringstream i{line};
+            boost::property_tree::read_json(i, json);
+            id = json.get("id", "");
+            if (auto p = json.get_optional<std::string>("path")) {
+                path = *p;
+                request = import_request_from_files(*path);
+            } else {
+                if (auto image = json.get_optional<std::string>("image")) {
+                    auto data = decode_base64(*image);
+                    auto io = std::make_unique<Exiv2::MemIo>();
+                    io->write(reinterpret_cast<Exiv2::byte const*>(data.data()), data.size());
+                    request.image = std::move(io);
+                }
+                request.exif = decode_base64(json.get("exif", ""));
+                request.xmp = json.get("xmp", "");
+                request.width = json.get("width", 0l);
+                request.height = json.get("height", 0l);
+                if (auto sidecar = json.get_optional<std::string>("sidecar")) request.sidecar = *sidecar;
+                request.pp3 = json.get("pp3", "");
+            }
+        } catch (std::exception const& e) {
+            import_result_t result;
+            result.error = std::string{"bad request: "} + e.what();
+            connection->write_line(response(id, result, false, 0));
+            return;
+        }
+
+        {
+            std::lock_guard lock{mutex_};
+            ++outstanding_;
+        }
+        importer_.submit(std::move(request), [this, connection, id, path, start](import_result_t result) {
+            if (path && result.status == import_result_t::status_t::imported) {
+                boost::filesystem::ofstream o{pp3_path(*path)};
+                o << result.pp3;
+                if (!o) {
+                    result.status = import_result_t::status_t::failed;
+                    result.error = "couldn't write " + pp3_path(*path).string();
+                }
+            }
+            auto latency = std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+            latencies_.add(latency);
+            connection->write_line(response(id, result, !path, latency));
+            std::lock_guard lock{mutex_};
+            if (--outstanding_ == 0) idle_.notify_all();
+        });
+    }
+
+    importer_t importer_;
+    latency_stats_t latencies_;
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    std::size_t readers_ = 0;
+    std::size_t outstanding_ = 0;
+};
+
+int listen_on(std::string const& socket_path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("socket path too long: " + socket_path);
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    // A socket left behind by a server that didn't shut down cleanly
+    struct stat s {};
+    if (::stat(socket_path.c_str(), &s) == 0 && S_ISSOCK(s.st_mode)) ::unlink(socket_path.c_str());
+
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (::bind(fd, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0 || ::listen(fd, 64) != 0) {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "couldn't listen on " + socket_path);
+    }
+    return fd;
+}
+
+}  // namespace
+
+int serve(serve_options_t const& options) {
+    std::signal(SIGPIPE, SIG_IGN);
+    server_t server{options.importer};
+    stop_signal_t stop;
+    if (options.socket_path == "-") {
+        server.serve_connection(std::make_shared<connection_t>(STDIN_FILENO, STDOUT_FILENO, false), stop.fd());
+    } else {
+        int listener;
+        try {
+            listener = listen_on(options.socket_path);
+        } catch (std::exception const& e) {
+            log_message(log_level_t::error, e.what());
+            return 1;
+        }
+        log_message(log_level_t::info, "Serving on ", options.socket_path);
+        pollfd fds[] = {{listener, POLLIN, 0}, {stop.fd(), POLLIN, 0}};
+        while (true) {
+            if (::poll(fds, 2, -1) < 0 && errno != EINTR) break;
+            if (fds[1].revents & POLLIN) break;
+            if (!(fds[0].revents & POLLIN)) continue;
+            auto client = ::accept(listener, nullptr, nullptr);
+            if (client < 0) continue;
+            ::fcntl(client, F_SETFD, FD_CLOEXEC);
+            server.serve_client(client, stop.fd());
+        }
+        ::close(listener);
+        ::unlink(options.socket_path.c_str());
+    }
+    server.wait_idle();
+    log_message(log_level_t::info, server.latencies());
+    return 0;
+}
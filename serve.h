@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+#include "lr2rt.h"
+
+struct serve_options_t {
+    std::string socket_path;  // "-" to serve stdin/stdout
+    importer_options_t importer;
+};
+
+// Serves import requests, one JSON object per line, from clients of a UNIX socket or from stdin, on one warm
+// importer_t. Requests are either
+//   {"id": ..., "path": "/photos/IMG_1.CR2"}
+// to import a file as the command line does, writing its profile, or
+//   {"id": ..., "image": "<base64>" or "exif": "<base64>", "xmp": "...", "width": ..., "height": ...,
+//    "sidecar": "...", "pp3": "..."}
+// to import buffers (see import_request_t) and get the profile back. Each request is answered as soon as it is done,
+// so answers may come out of order; the id is echoed back as a string:
+//   {"id": "...", "status": "imported", "pp3": "...", "error": "...", "latency_ms": 1.9}
+// Runs until stdin ends, or SIGINT/SIGTERM for a socket, then reports latency percentiles; returns the exit status.
+int serve(serve_options_t const& options);
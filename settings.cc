@@ -1,24 +1,15 @@
 #include "settings.h"
 
 #include <regex>
+#include <stdexcept>
 
 namespace {
 
 std::regex const category_regex{"^\\[(.*)\\]$"};
 std::regex const value_regex{"^(.*)=(.*)$"};
 
-auto pp3_path(const boost::filesystem::path& image_path) {
-    auto pp3_path = image_path;
-    auto new_ext = pp3_path.extension().string() + ".pp3";
-    pp3_path.replace_extension(new_ext);
-    return pp3_path;
-}
-
-}  // namespace
-
-void settings_t::load(const boost::filesystem::path& image_path) {
-    boost::filesystem::ifstream i{pp3_path(image_path)};
-    if (!i.is_open()) return;
+template <typename F>
+void parse(std::istream& i, F&& assign) {
     std::string category;
     std::string line;
     while (std::getline(i, line)) {
@@ -26,18 +17,108 @@ void settings_t::load(const boost::filesystem::path& image_path) {
         if (std::regex_match(line, match, category_regex)) {
             category = match[1];
         } else if (std::regex_match(line, match, value_regex)) {
-            settings_[category][match[1]] = match[2];
+            assign(category, match[1], match[2]);
+        }
+    }
+}
+
+std::string const* find(profile_t const& profile, std::string const& category, std::string const& key) {
+    auto i = profile.find(category);
+    if (i == profile.end()) return nullptr;
+    auto j = i->second.find(key);
+    return j == i->second.end() ? nullptr : &j->second;
+}
+
+// Calls f(key, base value or nullptr, override or nullptr) for the union of the keys, in order
+template <typename T, typename F>
+void merge(std::map<std::string, T> const& base, std::map<std::string, T> const& overrides, F&& f) {
+    T const* const none = nullptr;
+    auto b = base.begin();
+    auto o = overrides.begin();
+    while (b != base.end() || o != overrides.end()) {
+        if (o == overrides.end() || (b != base.end() && b->first < o->first)) {
+            f(b->first, &b->second, none);
+            ++b;
+        } else if (b == base.end() || o->first < b->first) {
+            f(o->first, none, &o->second);
+            ++o;
+        } else {
+            f(o->first, &b->second, &o->second);
+            ++b;
+            ++o;
         }
     }
 }
 
-void settings_t::commit_by(const boost::filesystem::path& image_path) const { commit(pp3_path(image_path)); }
+}  // namespace
 
-void settings_t::commit(const boost::filesystem::path& settings_path) const {
-    boost::filesystem::ofstream o{settings_path};
-    for (auto&& [category_name, category_contents] : settings_) {
-        o << "[" << category_name << "]" << std::endl;
-        for (auto&& [key, value] : category_contents) o << key << "=" << value << std::endl;
-        o << std::endl;
+boost::filesystem::path pp3_path(const boost::filesystem::path& image_path) {
+    auto pp3_path = image_path;
+    auto new_ext = pp3_path.extension().string() + ".pp3";
+    pp3_path.replace_extension(new_ext);
+    return pp3_path;
+}
+
+std::shared_ptr<profile_t const> read_base_profile(boost::filesystem::path const& path) {
+    boost::filesystem::ifstream i{path};
+    if (!i.is_open()) throw std::runtime_error{"Couldn't open profile " + path.string()};
+    auto profile = std::make_shared<profile_t>();
+    parse(i, [&](std::string const& category, std::string const& key, std::string const& value) {
+        (*profile)[category][key] = value;
+    });
+    return profile;
+}
+
+void settings_t::load(const boost::filesystem::path& image_path) { read(pp3_path(image_path)); }
+
+void settings_t::read(const boost::filesystem::path& settings_path) {
+    boost::filesystem::ifstream i{settings_path};
+    if (i.is_open()) read(i);
+}
+
+void settings_t::read(std::istream& i) {
+    parse(i, [this](std::string const& category, std::string const& key, std::string const& value) {
+        assign(category, key, value);
+    });
+}
+
+void settings_t::assign(std::string const& category, std::string const& key, std::string value) {
+    assigned_ = true;
+    auto base_value = base_ ? find(*base_, category, key) : nullptr;
+    if (base_value && *base_value == value) {
+        // Back to the base, e.g. a profile generated from it before
+        auto i = settings_.find(category);
+        if (i == settings_.end()) return;
+        i->second.erase(key);
+        if (i->second.empty()) settings_.erase(i);
+        return;
     }
+    settings_[category][key] = std::move(value);
+}
+
+std::size_t settings_t::commit_by(const boost::filesystem::path& image_path) const {
+    return commit(pp3_path(image_path));
+}
+
+std::size_t settings_t::commit(const boost::filesystem::path& settings_path) const {
+    boost::filesystem::ofstream o{settings_path};
+    if (!o.is_open()) throw std::runtime_error{"Couldn't create " + settings_path.string()};
+    write(o);
+    auto size = static_cast<std::size_t>(o.tellp());
+    o.close();
+    if (!o) throw std::runtime_error{"Couldn't write " + settings_path.string()};
+    return size;
+}
+
+void settings_t::write(std::ostream& o) const {
+    static profile_t const no_base;
+    static std::map<std::string, std::string> const no_values;
+    merge(base_ ? *base_ : no_base, settings_, [&](std::string const& category, auto base, auto overrides) {
+        o << "[" << category << "]\n";
+        merge(base ? *base : no_values, overrides ? *overrides : no_values,
+              [&](std::string const& key, auto base_value, auto value) {
+                  o << key << "=" << (value ? *value : *base_value) << "\n";
+              });
+        o << "\n";
+    });
 }
@@ -1,21 +1,50 @@
 #pragma once
 
 #include <boost/filesystem.hpp>
+#include <istream>
+#include <map>
+#include <memory>
+#include <ostream>
 
 #include "to_setting.h"
 
+// Path of the RawTherapee sidecar profile for the given image
+boost::filesystem::path pp3_path(boost::filesystem::path const& image_path);
+
+// Profile values by category and key
+using profile_t = std::map<std::string, std::map<std::string, std::string>>;
+
+// Parses a profile to share, read-only, as the base of many settings_t, e.g. a house default profile
+std::shared_ptr<profile_t const> read_base_profile(boost::filesystem::path const& path);
+
+// Settings, optionally on top of a base profile. Only values that differ from the base are held, so a copy costs as
+// much as the settings that were read or set; writing merges them into the base as it goes.
 class settings_t {
    public:
+    settings_t() = default;
+    explicit settings_t(std::shared_ptr<profile_t const> base) : base_{std::move(base)} {}
+
     template <typename T>
     void set(std::string const& category, std::string const& key, T const& value) {
-        settings_[category][key] = to_setting_string<T>(value);
+        assign(category, key, to_setting_string<T>(value));
     }
 
-    [[nodiscard]] bool empty() const { return settings_.empty(); }
+    // Whether nothing was read or set, so there's nothing to write. Values equal to the base profile count: the
+    // profile written for them is the base merged with them.
+    [[nodiscard]] bool empty() const { return !assigned_; }
     void load(boost::filesystem::path const& image_path);
-    void commit_by(boost::filesystem::path const& image_path) const;
-    void commit(boost::filesystem::path const& settings_path) const;
+    void read(boost::filesystem::path const& settings_path);
+    void read(std::istream& i);
+    // Write the profile, returning its size in bytes. Throws if it couldn't be written in full.
+    std::size_t commit_by(boost::filesystem::path const& image_path) const;
+    std::size_t commit(boost::filesystem::path const& settings_path) const;
+    void write(std::ostream& o) const;
 
    private:
-    std::map<std::string, std::map<std::string, std::string>> settings_;
+    void assign(std::string const& category, std::string const& key, std::string value);
+
+    std::shared_ptr<profile_t const> base_;
+    profile_t settings_;
+    // Whether anything was read or set, which settings_ doesn't tell once values equal to the base are left out
+    bool assigned_ = false;
 };
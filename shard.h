@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <cctype>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include "stable_hash.h"
+
+// Deterministic slice of the input files. A file belongs to shard i of N when the stable hash of its canonical path,
+// mixed so that its low bits depend on the whole path, is i mod N. Nodes given the same inputs and distinct indices
+// process disjoint, evenly sized sets that together cover everything, without coordinating.
+struct shard_t {
+    unsigned index = 0;
+    unsigned count = 1;
+
+    // Parses "i/N" with 0 <= i < N
+    static shard_t parse(std::string const& x) {
+        // Plain digits only: std::stoul would skip whitespace, negate a leading '-' and return more than unsigned holds
+        auto number = [](std::string const& digits) {
+            if (digits.empty() || !std::isdigit(static_cast<unsigned char>(digits[0])))
+                throw std::invalid_argument{digits};
+            std::size_t end = 0;
+            auto value = std::stoul(digits, &end);
+            if (end != digits.size()) throw std::invalid_argument{digits};
+            if (value > std::numeric_limits<unsigned>::max()) throw std::out_of_range{digits};
+            return static_cast<unsigned>(value);
+        };
+        auto slash = x.find('/');
+        shard_t shard;
+        try {
+            if (slash == std::string::npos) throw std::invalid_argument{x};
+            shard.index = number(x.substr(0, slash));
+            shard.count = number(x.substr(slash + 1));
+        } catch (std::logic_error const&) {
+            throw std::invalid_argument{"expected a shard as i/N, not \"" + x + "\""};
+        }
+        if (shard.count == 0 || shard.index >= shard.count)
+            throw std::invalid_argument{"expected a shard as i/N with 0 <= i < N, not \"" + x + "\""};
+        return shard;
+    }
+
+    [[nodiscard]] bool contains(std::uint64_t path_hash) const { return mix(path_hash) % count == index; }
+
+    // MurmurHash3's 64-bit finalizer; FNV-1a alone leaves the low bits a function of the low bits of each byte
+    static std::uint64_t mix(std::uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+};
+
+// Tally of the files a node considered and the ones its shard kept. Digests are sums of path hashes, so they don't
+// depend on the order files were found in: the shards of a run covered the input exactly once if every node reports
+// the same total, and their kept counts and digests add up to it.
+class shard_summary_t {
+   public:
+    explicit shard_summary_t(shard_t shard) : shard_{shard} {}
+
+    // Counts the file and returns whether it belongs to this shard
+    bool admit(boost::filesystem::path const& path) {
+        auto hash = stable_hash(path.string());
+        ++considered_;
+        considered_digest_ += hash;
+        if (!shard_.contains(hash)) return false;
+        ++kept_;
+        kept_digest_ += hash;
+        return true;
+    }
+
+    friend std::ostream& operator<<(std::ostream& s, shard_summary_t const& x) {
+        auto flags = s.flags();
+        s << "Shard " << x.shard_.index << "/" << x.shard_.count << ": kept " << x.kept_ << " of " << x.considered_
+          << " files, digest " << std::hex << std::setfill('0') << std::setw(16) << x.kept_digest_ << " of "
+          << std::setw(16) << x.considered_digest_ << std::setfill(' ');
+        s.flags(flags);
+        return s;
+    }
+
+   private:
+    shard_t const shard_;
+    std::atomic<std::uint64_t> considered_{0};
+    std::atomic<std::uint64_t> considered_digest_{0};
+    std::atomic<std::uint64_t> kept_{0};
+    std::atomic<std::uint64_t> kept_digest_{0};
+};
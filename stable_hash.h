@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// 64-bit FNV-1a. Unlike std::hash, the result is the same across builds, platforms and runs, so it can be persisted.
+inline std::uint64_t stable_hash(std::string_view x) {
+    std::uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : x) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
@@ -0,0 +1,46 @@
+#include "stop_signal.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <system_error>
+
+namespace {
+
+// Self-pipe written to by the signal handler
+int stop_pipe[2] = {-1, -1};
+
+void on_stop_signal(int) {
+    char c = 0;
+    [[maybe_unused]] auto n = ::write(stop_pipe[1], &c, 1);
+}
+
+void set_handlers(void (*handler)(int)) {
+    struct sigaction action {};
+    action.sa_handler = handler;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+}
+
+}  // namespace
+
+stop_signal_t::stop_signal_t() {
+    if (::pipe(stop_pipe) != 0) throw std::system_error(errno, std::generic_category(), "pipe");
+    for (auto end : stop_pipe) {
+        ::fcntl(end, F_SETFD, FD_CLOEXEC);
+        ::fcntl(end, F_SETFL, O_NONBLOCK);
+    }
+    set_handlers(on_stop_signal);
+}
+
+stop_signal_t::~stop_signal_t() {
+    set_handlers(SIG_DFL);
+    for (auto& end : stop_pipe) {
+        ::close(end);
+        end = -1;
+    }
+}
+
+int stop_signal_t::fd() const { return stop_pipe[0]; }
@@ -0,0 +1,13 @@
+#pragma once
+
+// While alive, turns SIGINT and SIGTERM into readability of fd(), so that a poll() loop can stop cleanly whichever
+// thread the signal lands on. The default handlers are restored on destruction.
+class stop_signal_t {
+   public:
+    stop_signal_t();
+    ~stop_signal_t();
+    stop_signal_t(stop_signal_t const&) = delete;
+    stop_signal_t& operator=(stop_signal_t const&) = delete;
+
+    [[nodiscard]] int fd() const;
+};
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Checks that lr2rt --serve crops images sent as metadata blocks the same as whole ones.
+
+Generates a small corpus with perf/make_corpus.py, then imports its cropped images through --serve both ways and
+compares the [Crop] sections of the profiles. Exits with status 1 if any differ.
+"""
+
+import argparse
+import base64
+import glob
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir, "perf"))
+import make_corpus  # noqa: E402
+
+
+def crop_section(pp3):
+    lines = pp3.splitlines()
+    if "[Crop]" not in lines:
+        return None
+    start = lines.index("[Crop]")
+    end = lines.index("", start) if "" in lines[start:] else len(lines)
+    return lines[start:end]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--lr2rt", required=True)
+    parser.add_argument("--work", required=True, help="scratch directory for the corpus")
+    parser.add_argument("--count", type=int, default=8, help="cropped images to compare")
+    args = parser.parse_args()
+
+    shutil.rmtree(args.work, ignore_errors=True)
+    corpus = os.path.join(args.work, "corpus")
+    subprocess.check_call([sys.executable, make_corpus.__file__, corpus, "--images", str(4 * args.count),
+                           "--raw-mib", "0", "--targets", "0"])
+
+    images = []
+    requests = []
+    for image in sorted(glob.glob(os.path.join(corpus, "*", "*", "*.dng"))):
+        with open(os.path.splitext(image)[0] + ".xmp") as f:
+            sidecar = f.read()
+        if 'crs:HasCrop="True"' not in sidecar:
+            continue
+        with open(image, "rb") as f:
+            # The stand-in's TIFF structure, which is also a valid Exif block
+            head = base64.b64encode(f.read()).decode()
+        images.append(image)
+        requests.append({"id": "whole " + image, "image": head, "sidecar": sidecar})
+        requests.append({"id": "blocks " + image, "exif": head, "width": make_corpus.WIDTH,
+                         "height": make_corpus.HEIGHT, "sidecar": sidecar})
+        if len(images) == args.count:
+            break
+    if not images:
+        raise SystemExit("The corpus has no cropped images")
+
+    served = subprocess.run([args.lr2rt, "--quiet", "--serve", "-"], check=True, stdout=subprocess.PIPE,
+                            input="".join(json.dumps(x) + "\n" for x in requests).encode())
+    crops = {}
+    for line in served.stdout.decode().splitlines():
+        answer = json.loads(line)
+        if answer["status"] != "imported":
+            raise SystemExit("%s: %s %s" % (answer["id"], answer["status"], answer.get("error", "")))
+        crops[answer["id"]] = crop_section(answer["pp3"])
+    mismatched = [x for x in images
+                  if crops.get("whole " + x) is None or crops["whole " + x] != crops.get("blocks " + x)]
+    if mismatched:
+        raise SystemExit("Importing as blocks crops differently from importing the image: " + ", ".join(mismatched))
+    print("%d cropped images crop the same imported whole or as blocks" % len(images))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "exiv2.h"
+
+// Exiv2-independent copy of a metadata value, holding just what get_value<T> needs to convert it.
+struct value_t {
+    enum class kind_t : std::uint8_t {
+        integer,   // Exif/TIFF integral types
+        real,      // Exif/TIFF rational and floating point types
+        text,      // plain strings, one item
+        lang_alt,  // language alternatives, one item holding the x-default entry
+        alt,       // rdf:Alt, one item per alternative
+        list,      // rdf:Bag or rdf:Seq, one item per element
+    };
+
+    kind_t kind = kind_t::text;
+    double number = 0;
+    std::vector<std::string> items;
+
+    // Returns nullopt for types get_value<T> doesn't support
+    static std::optional<value_t> from(Exiv2::Value const& x) {
+        value_t v;
+        switch (x.typeId()) {
+            case Exiv2::TypeId::unsignedByte:
+            case Exiv2::TypeId::unsignedShort:
+            case Exiv2::TypeId::unsignedLong:
+            case Exiv2::TypeId::signedByte:
+            case Exiv2::TypeId::signedShort:
+            case Exiv2::TypeId::signedLong:
+            case Exiv2::TypeId::unsignedLongLong:
+            case Exiv2::TypeId::signedLongLong:
+            case Exiv2::TypeId::tiffIfd8:
+                v.kind = kind_t::integer;
+                v.number = x.toLong();
+                return v;
+
+            case Exiv2::TypeId::unsignedRational:
+            case Exiv2::TypeId::signedRational:
+            case Exiv2::TypeId::tiffFloat:
+            case Exiv2::TypeId::tiffDouble:
+                v.kind = kind_t::real;
+                v.number = x.toFloat();
+                return v;
+
+            case Exiv2::TypeId::asciiString:
+            case Exiv2::TypeId::string:
+            case Exiv2::TypeId::xmpText:
+                v.kind = kind_t::text;
+                v.items.push_back(x.toString());
+                return v;
+
+            case Exiv2::TypeId::langAlt:
+                v.kind = kind_t::lang_alt;
+                v.items.push_back(x.toString(1));
+                return v;
+
+            case Exiv2::TypeId::xmpAlt:
+            case Exiv2::TypeId::xmpBag:
+            case Exiv2::TypeId::xmpSeq:
+                v.kind = x.typeId() == Exiv2::TypeId::xmpAlt ? kind_t::alt : kind_t::list;
+                for (long i = 0; i < x.count(); ++i) v.items.push_back(x.toString(i));
+                return v;
+
+            default:
+                return std::nullopt;
+        }
+    }
+
+    friend bool operator==(value_t const& a, value_t const& b) {
+        return a.kind == b.kind && a.number == b.number && a.items == b.items;
+    }
+    friend bool operator!=(value_t const& a, value_t const& b) { return !(a == b); }
+
+    friend std::ostream& operator<<(std::ostream& s, value_t const& x) {
+        switch (x.kind) {
+            case kind_t::integer:
+            case kind_t::real:
+                return s << x.number;
+            default:
+                break;
+        }
+        bool any = false;
+        for (auto&& item : x.items) {
+            if (any) s << ", ";
+            s << item;
+            any = true;
+        }
+        return s;
+    }
+};
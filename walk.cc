@@ -0,0 +1,173 @@
+#include "walk.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "log.h"
+
+std::set<std::string> parse_extensions(std::string const& list) {
+    std::vector<std::string> items;
+    boost::split(items, list, [](char c) { return c == ','; });
+    std::set<std::string> extensions;
+    for (auto&& item : items) {
+        auto extension = boost::to_lower_copy(boost::trim_copy(item));
+        if (extension == "*") return {};
+        if (extension.empty()) continue;
+        if (extension.front() != '.') extension.insert(0, 1, '.');
+        extensions.insert(std::move(extension));
+    }
+    return extensions;
+}
+
+namespace {
+
+enum class entry_type_t { file, linked_file, directory, other };
+
+// Falls back on stat only where the listing doesn't say, or for symlinks, which are resolved
+entry_type_t entry_type(dirent const& entry, std::string const& path) {
+    switch (entry.d_type) {
+        case DT_REG:
+            return entry_type_t::file;
+        case DT_DIR:
+            return entry_type_t::directory;
+        case DT_UNKNOWN: {
+            struct stat s {};
+            if (::lstat(path.c_str(), &s) != 0) return entry_type_t::other;
+            if (S_ISREG(s.st_mode)) return entry_type_t::file;
+            if (S_ISDIR(s.st_mode)) return entry_type_t::directory;
+            if (!S_ISLNK(s.st_mode)) return entry_type_t::other;
+            [[fallthrough]];
+        }
+        case DT_LNK: {
+            struct stat s {};
+            if (::stat(path.c_str(), &s) != 0 || !S_ISREG(s.st_mode)) return entry_type_t::other;
+            return entry_type_t::linked_file;
+        }
+        default:
+            return entry_type_t::other;
+    }
+}
+
+std::string extension_of(std::string const& name) {
+    auto dot = name.rfind('.');
+    if (dot == std::string::npos || dot == 0) return {};
+    return boost::to_lower_copy(name.substr(dot));
+}
+
+}  // namespace
+
+bool is_allowed_image(std::string const& name, std::set<std::string> const& extensions) {
+    auto extension = extension_of(name);
+    if (extension == ".xmp" || extension == ".pp3") return false;
+    return extensions.empty() || extensions.count(extension);
+}
+
+namespace {
+
+// Directories still to be listed, shared by the walking threads. The walk is over once none are left and no thread
+// is listing one, since only listing finds more.
+class walk_t {
+   public:
+    walk_t(walk_options_t const& options, std::function<void(walked_image_t)> const& f) : options_{options}, f_{f} {}
+
+    void run(boost::filesystem::path const& root) {
+        directories_.push_back(root.string());
+        auto jobs = options_.jobs ? options_.jobs : std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for (unsigned n = 0; n < jobs; ++n) threads.emplace_back([this] { work(); });
+        for (auto&& thread : threads) thread.join();
+    }
+
+   private:
+    void work() {
+        std::unique_lock lock{mutex_};
+        while (true) {
+            changed_.wait(lock, [&] { return !directories_.empty() || busy_ == 0; });
+            if (directories_.empty()) return;
+            auto directory = std::move(directories_.back());
+            directories_.pop_back();
+            ++busy_;
+            lock.unlock();
+            auto subdirectories = list(directory);
+            lock.lock();
+            --busy_;
+            for (auto&& subdirectory : subdirectories) directories_.push_back(std::move(subdirectory));
+            changed_.notify_all();
+        }
+    }
+
+    // Reports the directory's images and returns its subdirectories
+    std::vector<std::string> list(std::string const& directory) {
+        std::vector<std::string> subdirectories;
+        std::vector<std::pair<std::string, bool>> files;  // name, whether it is a symlink
+        std::unordered_set<std::string> names;
+        auto dir = ::opendir(directory.c_str());
+        if (!dir) {
+            log_message(log_level_t::error, "Couldn't read ", directory, ": ", std::strerror(errno));
+            return subdirectories;
+        }
+        while (auto entry = ::readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..") continue;
+            auto path = directory + '/' + name;
+            auto type = entry_type(*entry, path);
+            switch (type) {
+                case entry_type_t::directory:
+                    subdirectories.push_back(std::move(path));
+                    break;
+                case entry_type_t::file:
+                case entry_type_t::linked_file:
+                    names.insert(name);
+                    if (allowed(name)) files.emplace_back(std::move(name), type == entry_type_t::linked_file);
+                    break;
+                case entry_type_t::other:
+                    break;
+            }
+        }
+        ::closedir(dir);
+
+        for (auto&& [name, linked] : files) {
+            walked_image_t image;
+            image.path = boost::filesystem::path{directory} / name;
+            image.has_xmp_sidecar = names.count(image.path.stem().string() + ".xmp") > 0;
+            image.has_pp3 = names.count(name + ".pp3") > 0;
+            if (linked) {
+                // The sidecars that count are the ones next to the target, which this listing doesn't cover
+                boost::system::error_code ec;
+                auto target = boost::filesystem::canonical(image.path, ec);
+                if (!ec) image = walked_image_t{std::move(target), true, true};
+            }
+            f_(std::move(image));
+        }
+        return subdirectories;
+    }
+
+    bool allowed(std::string const& name) const { return is_allowed_image(name, options_.extensions); }
+
+    walk_options_t const& options_;
+    std::function<void(walked_image_t)> const& f_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::vector<std::string> directories_;
+    unsigned busy_ = 0;
+};
+
+}  // namespace
+
+void walk_images(boost::filesystem::path const& root,
+                 walk_options_t const& options,
+                 std::function<void(walked_image_t)> const& f) {
+    walk_t{options, f}.run(root);
+}
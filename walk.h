@@ -0,0 +1,37 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <functional>
+#include <set>
+#include <string>
+
+// Raw formats imported from directories unless --extensions says otherwise
+constexpr char const* default_raw_extensions =
+    "3fr,ari,arw,cr2,cr3,crw,dcr,dng,erf,fff,iiq,k25,kdc,mef,mos,mrw,nef,nrw,orf,pef,raf,raw,rw2,rwl,sr2,srf,srw,x3f";
+
+// Parses a comma-separated list of extensions ("cr2,.NEF") into lowercase ones with a leading dot; "*" allows any
+std::set<std::string> parse_extensions(std::string const& list);
+
+// Whether a file name is that of an image to import under the allowlist (as from parse_extensions; empty allows any).
+// Sidecars and profiles never are, whatever the allowlist says.
+bool is_allowed_image(std::string const& name, std::set<std::string> const& extensions);
+
+// An image found by walk_images, with what was found next to it in the same directory listing
+struct walked_image_t {
+    boost::filesystem::path path;
+    bool has_xmp_sidecar = false;
+    bool has_pp3 = false;
+};
+
+struct walk_options_t {
+    std::set<std::string> extensions;  // as from parse_extensions; empty allows any
+    unsigned jobs = 0;                 // directories read in parallel; 0 for one per core
+};
+
+// Calls `f` for every file below `root` with an allowed extension, from several threads at once. Each directory is
+// listed once, and file types come from the listing itself (d_type), so plain files and directories cost no stat;
+// the listing also tells which images have an XMP sidecar or a profile. Paths are canonical if `root` is: symlinks
+// to files are resolved, symlinks to directories aren't followed. Unreadable directories are reported and skipped.
+void walk_images(boost::filesystem::path const& root,
+                 walk_options_t const& options,
+                 std::function<void(walked_image_t)> const& f);
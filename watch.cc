@@ -0,0 +1,212 @@
+#include "watch.h"
+
+#include <stdexcept>
+
+#if TARGET_OS_IS_APPLE
+
+struct watcher_t::impl_t {};
+
+watcher_t::watcher_t(std::vector<boost::filesystem::path> const&, walk_options_t const&, std::chrono::milliseconds) {
+    throw std::runtime_error("--watch needs inotify, which isn't available on this platform");
+}
+
+watcher_t::~watcher_t() = default;
+
+void watcher_t::run(pipeline_t&) {}
+
+#else
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <unordered_map>
+
+#include "log.h"
+#include "metadata.h"
+#include "stop_signal.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr std::uint32_t directory_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+bool has_extension(boost::filesystem::path const& path, char const* extension) {
+    return boost::iequals(path.extension().string(), extension);
+}
+
+}  // namespace
+
+struct watcher_t::impl_t {
+    impl_t(std::vector<boost::filesystem::path> const& roots,
+           walk_options_t const& walk_options,
+           std::chrono::milliseconds debounce)
+        : roots{roots}, walk_options{walk_options}, debounce{debounce}, fd{::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)} {
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), "inotify_init1");
+        for (auto&& root : roots) add_tree(root, false);
+    }
+
+    ~impl_t() { ::close(fd); }
+
+    void add_watch(boost::filesystem::path const& directory) {
+        auto wd = ::inotify_add_watch(fd, directory.c_str(), directory_mask);
+        if (wd < 0) {
+            auto hint = errno == ENOSPC ? " (fs.inotify.max_user_watches may need raising)" : "";
+            log_message(log_level_t::error, "Couldn't watch ", directory, ": ", std::strerror(errno), hint);
+            return;
+        }
+        directories[wd] = directory;
+    }
+
+    // Watches a directory and everything below it, then walks it for the images already there. Each directory is
+    // watched before it is walked, so a file created in between is seen one way or the other.
+    void add_tree(boost::filesystem::path const& root, bool submit_existing) {
+        add_watch(root);
+        boost::system::error_code ec;
+        for (boost::filesystem::recursive_directory_iterator i{root, ec}, end; !ec && i != end; i.increment(ec)) {
+            if (boost::filesystem::is_directory(i->symlink_status())) add_watch(i->path());
+        }
+        if (!submit_existing) return;
+        std::mutex mutex;
+        auto deadline = clock_type::now() + debounce;
+        walk_images(root, walk_options, [&](walked_image_t image) {
+            std::lock_guard lock{mutex};
+            pending[image.path] = deadline;
+            auto path = image.path;
+            walked.insert_or_assign(std::move(path), std::move(image));
+        });
+    }
+
+    // Pushes back the file's deadline, so that a burst of writes ends up as one submission. Sidecars stand for their
+    // images (see affected_images); other files that aren't images to import are ignored.
+    void touch(boost::filesystem::path const& path) {
+        if (!has_extension(path, ".xmp") && !is_allowed_image(path.filename().string(), walk_options.extensions))
+            return;
+        pending[path] = clock_type::now() + debounce;
+        // What the walk saw next to it may be out of date now
+        walked.erase(path);
+    }
+
+    void read_events() {
+        alignas(inotify_event) char buffer[64 * 1024];
+        while (true) {
+            auto length = ::read(fd, buffer, sizeof buffer);
+            if (length <= 0) return;
+            for (char const* p = buffer; p < buffer + length;) {
+                auto&& event = *reinterpret_cast<inotify_event const*>(p);
+                p += sizeof(inotify_event) + event.len;
+                handle(event);
+            }
+        }
+    }
+
+    void handle(inotify_event const& event) {
+        if (event.mask & IN_Q_OVERFLOW) {
+            log_message(log_level_t::warning, "Missed filesystem events; rescanning all watched directories");
+            for (auto&& root : roots) add_tree(root, true);
+            return;
+        }
+        if (event.mask & IN_IGNORED) {
+            directories.erase(event.wd);
+            return;
+        }
+        auto directory = directories.find(event.wd);
+        if (directory == directories.end() || !event.len) return;
+        auto path = directory->second / event.name;
+        if (event.mask & IN_ISDIR) {
+            if (event.mask & (IN_CREATE | IN_MOVED_TO)) add_tree(path, true);
+        } else if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            touch(path);
+        }
+    }
+
+    // Images affected by a change to `path`: a sidecar stands for the images it belongs to
+    void affected_images(boost::filesystem::path const& path, std::set<boost::filesystem::path>& images) const {
+        if (!has_extension(path, ".xmp")) {
+            images.insert(path);
+            return;
+        }
+        boost::system::error_code ec;
+        for (boost::filesystem::directory_iterator i{path.parent_path(), ec}, end; !ec && i != end; i.increment(ec)) {
+            auto&& image = i->path();
+            if (xmp_sidecar_path(image) == path &&
+                is_allowed_image(image.filename().string(), walk_options.extensions) &&
+                boost::filesystem::is_regular_file(i->status()))
+                images.insert(image);
+        }
+    }
+
+    // Submits the files that have gone quiet (or all of them) and returns the poll timeout until the next is due
+    int flush(pipeline_t& pipeline, bool all) {
+        auto now = clock_type::now();
+        auto next = clock_type::time_point::max();
+        std::set<boost::filesystem::path> images;
+        std::vector<walked_image_t> walked_images;
+        for (auto i = pending.begin(); i != pending.end();) {
+            if (all || i->second <= now) {
+                auto image = walked.find(i->first);
+                if (image != walked.end()) {
+                    walked_images.push_back(std::move(image->second));
+                    walked.erase(image);
+                } else {
+                    affected_images(i->first, images);
+                }
+                i = pending.erase(i);
+            } else {
+                next = std::min(next, i->second);
+                ++i;
+            }
+        }
+        for (auto&& image : walked_images) {
+            // A changed sidecar already brings the image in, looking for the sidecar itself
+            if (!images.count(image.path)) pipeline.submit(std::move(image));
+        }
+        for (auto&& image : images) pipeline.submit(image);
+        if (next == clock_type::time_point::max()) return -1;
+        return std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+    }
+
+    void run(pipeline_t& pipeline) {
+        stop_signal_t stop;
+        log_message(log_level_t::info, "Watching ", directories.size(), " directories for changes");
+        pollfd fds[] = {{fd, POLLIN, 0}, {stop.fd(), POLLIN, 0}};
+        int timeout = -1;
+        while (true) {
+            if (::poll(fds, 2, timeout) < 0 && errno != EINTR)
+                throw std::system_error(errno, std::generic_category(), "poll");
+            if (fds[1].revents & POLLIN) break;
+            if (fds[0].revents & POLLIN) read_events();
+            timeout = flush(pipeline, false);
+        }
+        log_message(log_level_t::info, "Stopped watching");
+        flush(pipeline, true);
+    }
+
+    std::vector<boost::filesystem::path> const roots;
+    walk_options_t const walk_options;
+    std::chrono::milliseconds const debounce;
+    int const fd;
+    std::unordered_map<int, boost::filesystem::path> directories;
+    std::map<boost::filesystem::path, clock_type::time_point> pending;
+    // Images among the pending files that were found by walking a new directory, with what the walk saw next to them
+    std::map<boost::filesystem::path, walked_image_t> walked;
+};
+
+watcher_t::watcher_t(std::vector<boost::filesystem::path> const& directories,
+                     walk_options_t const& walk_options,
+                     std::chrono::milliseconds debounce)
+    : impl_{std::make_unique<impl_t>(directories, walk_options, debounce)} {}
+
+watcher_t::~watcher_t() = default;
+
+void watcher_t::run(pipeline_t& pipeline) { impl_->run(pipeline); }
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "pipeline.h"
+#include "walk.h"
+
+// Watches directory trees with inotify and resubmits images to the pipeline when they or their XMP sidecars are
+// written. Only files the walk options allow count as images, as for the initial import. Watches are set up on
+// construction, so nothing written while the initial import runs is missed. Events for the same file are debounced: a
+// file is submitted once nothing has touched it for `debounce`. Directories created or moved into a watched tree are
+// watched too, and the images already in them walked and submitted.
+class watcher_t {
+   public:
+    watcher_t(std::vector<boost::filesystem::path> const& directories,
+              walk_options_t const& walk_options,
+              std::chrono::milliseconds debounce);
+    ~watcher_t();
+
+    // Blocks until SIGINT or SIGTERM, feeding changed files to the pipeline
+    void run(pipeline_t& pipeline);
+
+   private:
+    struct impl_t;
+    std::unique_ptr<impl_t> impl_;
+};
@@ -0,0 +1,543 @@
+#include "xmp_sidecar.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "metadata.h"
+
+namespace {
+
+std::string_view const rdf_ns = "http://www.w3.org/1999/02/22-rdf-syntax-ns#";
+std::string_view const xml_ns = "http://www.w3.org/XML/1998/namespace";
+std::string_view const meta_ns = "adobe:ns:meta/";
+std::string_view const dc_ns = "http://purl.org/dc/elements/1.1/";
+
+struct recorded_namespace_t {
+    std::string_view uri;
+    std::string_view prefix;
+};
+
+// Namespace URIs of the recorded keys, with the prefix Exiv2 registers for them
+recorded_namespace_t const recorded_namespaces[] = {
+    {"http://ns.adobe.com/camera-raw-settings/1.0/", "crs"},
+    {dc_ns, "dc"},
+    {"http://ns.adobe.com/lightroom/1.0/", "lr"},
+    {"http://ns.adobe.com/tiff/1.0/", "tiff"},
+    {"http://ns.adobe.com/xap/1.0/", "xmp"},
+};
+
+// Array forms the XMP toolkit forces onto simple Dublin Core properties when parsing
+struct dc_array_form_t {
+    std::string_view name;
+    value_t::kind_t kind;
+};
+
+dc_array_form_t const dc_array_forms[] = {
+    {"contributor", value_t::kind_t::list},
+    {"creator", value_t::kind_t::list},
+    {"date", value_t::kind_t::list},
+    {"description", value_t::kind_t::lang_alt},
+    {"language", value_t::kind_t::list},
+    {"publisher", value_t::kind_t::list},
+    {"relation", value_t::kind_t::list},
+    {"rights", value_t::kind_t::lang_alt},
+    {"subject", value_t::kind_t::list},
+    {"title", value_t::kind_t::lang_alt},
+    {"type", value_t::kind_t::list},
+};
+
+std::atomic<std::uint64_t> fast_count{0};
+std::atomic<std::uint64_t> fallback_count{0};
+
+// Thrown internally when the packet uses something the fast path doesn't handle
+struct unsupported_t {};
+
+struct name_t {
+    std::string_view uri;
+    std::string_view local;
+
+    [[nodiscard]] bool is(std::string_view u, std::string_view l) const { return uri == u && local == l; }
+};
+
+struct tag_t {
+    std::string_view qname;
+    std::vector<std::pair<std::string_view, std::string_view>> attributes;
+    bool is_end = false;
+    bool is_empty = false;
+};
+
+bool is_blank(std::string_view x) { return x.find_first_not_of(" \t\r\n") == std::string_view::npos; }
+
+bool is_namespace_declaration(std::string_view qname) { return qname == "xmlns" || qname.substr(0, 6) == "xmlns:"; }
+
+void append_utf8(std::string& out, unsigned long c) {
+    if (c < 0x80) {
+        out += char(c);
+    } else if (c < 0x800) {
+        out += char(0xc0 | (c >> 6));
+        out += char(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        out += char(0xe0 | (c >> 12));
+        out += char(0x80 | ((c >> 6) & 0x3f));
+        out += char(0x80 | (c & 0x3f));
+    } else if (c < 0x110000) {
+        out += char(0xf0 | (c >> 18));
+        out += char(0x80 | ((c >> 12) & 0x3f));
+        out += char(0x80 | ((c >> 6) & 0x3f));
+        out += char(0x80 | (c & 0x3f));
+    } else {
+        throw unsupported_t{};
+    }
+}
+
+// Resolves entity and character references and normalizes line ends (and, in attributes, whitespace) like an XML
+// parser would
+std::string decode(std::string_view raw, bool attribute) {
+    std::string out;
+    out.reserve(raw.size());
+    for (std::size_t i = 0; i < raw.size(); ++i) {
+        auto c = raw[i];
+        if (c == '&') {
+            auto end = raw.find(';', i);
+            if (end == std::string_view::npos) throw unsupported_t{};
+            auto entity = raw.substr(i + 1, end - i - 1);
+            if (entity == "amp")
+                out += '&';
+            else if (entity == "lt")
+                out += '<';
+            else if (entity == "gt")
+                out += '>';
+            else if (entity == "quot")
+                out += '"';
+            else if (entity == "apos")
+                out += '\'';
+            else if (entity.size() > 1 && entity[0] == '#') {
+                auto hex = entity[1] == 'x';
+                auto digits = std::string(entity.substr(hex ? 2 : 1));
+                if (digits.empty() || digits.find_first_not_of(hex ? "0123456789abcdefABCDEF" : "0123456789") !=
+                                          std::string::npos)
+                    throw unsupported_t{};
+                append_utf8(out, std::stoul(digits, nullptr, hex ? 16 : 10));
+            } else {
+                throw unsupported_t{};
+            }
+            i = end;
+        } else if (c == '\r') {
+            if (i + 1 < raw.size() && raw[i + 1] == '\n') ++i;
+            out += attribute ? ' ' : '\n';
+        } else if (attribute && (c == '\t' || c == '\n')) {
+            out += ' ';
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+class parser_t {
+   public:
+    explicit parser_t(std::string_view x) : x_{x} {}
+
+    std::map<std::string, value_t> parse() {
+        if (x_.substr(0, 3) == "\xef\xbb\xbf") p_ = 3;
+        auto root = expect_tag();
+        if (root.is_end) throw unsupported_t{};
+        auto mark = enter(root);
+        auto name = resolve(root.qname, false);
+        if (name.is(meta_ns, "xmpmeta")) {
+            if (root.is_empty) throw unsupported_t{};
+            auto rdf = expect_tag();
+            if (rdf.is_end) throw unsupported_t{};
+            auto rdf_mark = enter(rdf);
+            if (!resolve(rdf.qname, false).is(rdf_ns, "RDF")) throw unsupported_t{};
+            parse_rdf(rdf);
+            leave(rdf_mark);
+            expect_end(root);
+        } else if (name.is(rdf_ns, "RDF")) {
+            parse_rdf(root);
+        } else {
+            throw unsupported_t{};
+        }
+        leave(mark);
+        return std::move(values_);
+    }
+
+   private:
+    // Reads the next tag, collecting the raw text before it and skipping comments and processing instructions.
+    // Returns false at the end of input.
+    bool next_tag(tag_t& tag, std::string& text) {
+        tag = tag_t{};
+        while (true) {
+            auto lt = x_.find('<', p_);
+            if (lt == std::string_view::npos) {
+                text += x_.substr(p_);
+                p_ = x_.size();
+                return false;
+            }
+            text += x_.substr(p_, lt - p_);
+            p_ = lt;
+            if (x_.compare(p_, 4, "<!--") == 0) {
+                skip_past("-->");
+            } else if (x_.compare(p_, 2, "<?") == 0) {
+                skip_past("?>");
+            } else if (x_.compare(p_, 2, "<!") == 0) {
+                throw unsupported_t{};
+            } else {
+                read_tag(tag);
+                return true;
+            }
+        }
+    }
+
+    // Next tag, allowing only whitespace before it
+    tag_t expect_tag() {
+        tag_t tag;
+        std::string text;
+        if (!next_tag(tag, text) || !is_blank(text)) throw unsupported_t{};
+        return tag;
+    }
+
+    void expect_end(tag_t const& start) {
+        auto tag = expect_tag();
+        if (!tag.is_end || tag.qname != start.qname) throw unsupported_t{};
+    }
+
+    void skip_past(std::string_view terminator) {
+        auto end = x_.find(terminator, p_);
+        if (end == std::string_view::npos) throw unsupported_t{};
+        p_ = end + terminator.size();
+    }
+
+    void skip_space() {
+        while (p_ < x_.size() && (x_[p_] == ' ' || x_[p_] == '\t' || x_[p_] == '\r' || x_[p_] == '\n')) ++p_;
+    }
+
+    std::string_view read_name() {
+        auto start = p_;
+        while (p_ < x_.size() && x_[p_] != ' ' && x_[p_] != '\t' && x_[p_] != '\r' && x_[p_] != '\n' &&
+               x_[p_] != '/' && x_[p_] != '>' && x_[p_] != '=')
+            ++p_;
+        if (p_ == start || p_ == x_.size()) throw unsupported_t{};
+        return x_.substr(start, p_ - start);
+    }
+
+    void read_tag(tag_t& tag) {
+        ++p_;
+        if (p_ < x_.size() && x_[p_] == '/') {
+            ++p_;
+            tag.is_end = true;
+            tag.qname = read_name();
+            skip_space();
+            if (p_ >= x_.size() || x_[p_] != '>') throw unsupported_t{};
+            ++p_;
+            return;
+        }
+        tag.qname = read_name();
+        while (true) {
+            skip_space();
+            if (p_ >= x_.size()) throw unsupported_t{};
+            if (x_[p_] == '>') {
+                ++p_;
+                return;
+            }
+            if (x_.compare(p_, 2, "/>") == 0) {
+                p_ += 2;
+                tag.is_empty = true;
+                return;
+            }
+            auto name = read_name();
+            skip_space();
+            if (p_ >= x_.size() || x_[p_] != '=') throw unsupported_t{};
+            ++p_;
+            skip_space();
+            if (p_ >= x_.size() || (x_[p_] != '"' && x_[p_] != '\'')) throw unsupported_t{};
+            auto quote = x_[p_++];
+            auto end = x_.find(quote, p_);
+            if (end == std::string_view::npos) throw unsupported_t{};
+            tag.attributes.emplace_back(name, x_.substr(p_, end - p_));
+            p_ = end + 1;
+        }
+    }
+
+    // Skips everything up to and including the end tag matching `start`
+    void skip_content(tag_t const& start) {
+        if (start.is_empty) return;
+        int depth = 0;
+        tag_t tag;
+        std::string text;
+        while (next_tag(tag, text)) {
+            if (tag.is_end) {
+                if (depth-- == 0) {
+                    if (tag.qname != start.qname) throw unsupported_t{};
+                    return;
+                }
+            } else if (!tag.is_empty) {
+                ++depth;
+            }
+        }
+        throw unsupported_t{};
+    }
+
+    std::size_t enter(tag_t const& tag) {
+        auto mark = namespaces_.size();
+        for (auto&& [name, value] : tag.attributes) {
+            if (!is_namespace_declaration(name)) continue;
+            if (value.find('&') != std::string_view::npos) throw unsupported_t{};
+            namespaces_.emplace_back(name.size() > 5 ? name.substr(6) : std::string_view{}, value);
+        }
+        return mark;
+    }
+
+    void leave(std::size_t mark) { namespaces_.resize(mark); }
+
+    name_t resolve(std::string_view qname, bool attribute) const {
+        auto colon = qname.find(':');
+        auto prefix = colon == std::string_view::npos ? std::string_view{} : qname.substr(0, colon);
+        auto local = colon == std::string_view::npos ? qname : qname.substr(colon + 1);
+        if (prefix == "xml") return {xml_ns, local};
+        if (prefix.empty() && attribute) return {{}, local};
+        for (auto i = namespaces_.rbegin(); i != namespaces_.rend(); ++i)
+            if (i->first == prefix) return {i->second, local};
+        throw unsupported_t{};
+    }
+
+    static std::optional<std::string_view> recorded_prefix(std::string_view uri) {
+        for (auto&& ns : recorded_namespaces)
+            if (ns.uri == uri) return ns.prefix;
+        return std::nullopt;
+    }
+
+    void emit(std::string_view prefix, std::string_view local, value_t value) {
+        std::string key = "Xmp.";
+        key.append(prefix).append(".").append(local);
+        if (!is_recorded_key(key)) return;
+        if (!values_.emplace(std::move(key), std::move(value)).second) throw unsupported_t{};
+    }
+
+    static value_t text_value(std::string text) {
+        value_t value;
+        value.kind = value_t::kind_t::text;
+        value.items.push_back(std::move(text));
+        return value;
+    }
+
+    void parse_rdf(tag_t const& rdf) {
+        if (rdf.is_empty) return;
+        while (true) {
+            auto tag = expect_tag();
+            if (tag.is_end) {
+                if (tag.qname != rdf.qname) throw unsupported_t{};
+                return;
+            }
+            auto mark = enter(tag);
+            if (!resolve(tag.qname, false).is(rdf_ns, "Description")) throw unsupported_t{};
+            parse_description(tag);
+            leave(mark);
+        }
+    }
+
+    void parse_description(tag_t const& description) {
+        for (auto&& [qname, raw] : description.attributes) {
+            if (is_namespace_declaration(qname)) continue;
+            auto name = resolve(qname, true);
+            if (name.is(rdf_ns, "about")) continue;
+            if (name.uri == rdf_ns || name.uri == xml_ns || name.uri.empty()) throw unsupported_t{};
+            if (auto prefix = recorded_prefix(name.uri)) {
+                emit(*prefix, name.local, simple_value(name, decode(raw, true)));
+            }
+        }
+        if (description.is_empty) return;
+        while (true) {
+            auto tag = expect_tag();
+            if (tag.is_end) {
+                if (tag.qname != description.qname) throw unsupported_t{};
+                return;
+            }
+            auto mark = enter(tag);
+            parse_property(tag);
+            leave(mark);
+        }
+    }
+
+    // A simple text value, in the array form the XMP toolkit normalizes some Dublin Core properties to
+    static value_t simple_value(name_t const& name, std::string text) {
+        auto value = text_value(std::move(text));
+        if (name.uri != dc_ns) return value;
+        for (auto&& form : dc_array_forms)
+            if (form.name == name.local) value.kind = form.kind;
+        return value;
+    }
+
+    void parse_property(tag_t const& property) {
+        auto name = resolve(property.qname, false);
+        auto prefix = recorded_prefix(name.uri);
+        bool structure = false;
+        for (auto&& [qname, raw] : property.attributes) {
+            if (is_namespace_declaration(qname)) continue;
+            if (resolve(qname, true).is(rdf_ns, "parseType") && raw == "Resource")
+                structure = true;
+            else if (prefix)
+                throw unsupported_t{};
+        }
+        if (!prefix) {
+            skip_content(property);
+            return;
+        }
+        if (structure) {
+            // Exiv2 records structures as an empty text value, with the fields as separate keys we don't record
+            skip_content(property);
+            emit(*prefix, name.local, text_value({}));
+            return;
+        }
+        if (property.is_empty) {
+            emit(*prefix, name.local, simple_value(name, {}));
+            return;
+        }
+        tag_t tag;
+        std::string text;
+        if (!next_tag(tag, text)) throw unsupported_t{};
+        if (tag.is_end) {
+            if (tag.qname != property.qname) throw unsupported_t{};
+            emit(*prefix, name.local, simple_value(name, decode(text, false)));
+            return;
+        }
+        if (!is_blank(text)) throw unsupported_t{};
+        auto mark = enter(tag);
+        auto child = resolve(tag.qname, false);
+        if (child.is(rdf_ns, "Bag") || child.is(rdf_ns, "Seq") || child.is(rdf_ns, "Alt")) {
+            emit(*prefix, name.local, parse_array(tag, child.local == "Alt"));
+        } else if (child.is(rdf_ns, "Description")) {
+            skip_content(tag);
+            emit(*prefix, name.local, text_value({}));
+        } else {
+            throw unsupported_t{};
+        }
+        leave(mark);
+        expect_end(property);
+    }
+
+    value_t parse_array(tag_t const& array, bool alternative) {
+        std::vector<std::string> items;
+        std::vector<std::optional<std::string>> languages;
+        bool simple = true;
+        if (!array.is_empty) {
+            while (true) {
+                auto tag = expect_tag();
+                if (tag.is_end) {
+                    if (tag.qname != array.qname) throw unsupported_t{};
+                    break;
+                }
+                auto mark = enter(tag);
+                if (!resolve(tag.qname, false).is(rdf_ns, "li")) throw unsupported_t{};
+                std::optional<std::string> language;
+                bool structure = false;
+                for (auto&& [qname, raw] : tag.attributes) {
+                    if (is_namespace_declaration(qname)) continue;
+                    auto name = resolve(qname, true);
+                    if (name.is(xml_ns, "lang"))
+                        language = decode(raw, true);
+                    else if (name.is(rdf_ns, "parseType") && raw == "Resource")
+                        structure = true;
+                    else
+                        throw unsupported_t{};
+                }
+                std::string item;
+                if (structure) {
+                    skip_content(tag);
+                    simple = false;
+                } else if (!tag.is_empty) {
+                    tag_t next;
+                    std::string text;
+                    if (!next_tag(next, text)) throw unsupported_t{};
+                    if (next.is_end) {
+                        if (next.qname != tag.qname) throw unsupported_t{};
+                        item = decode(text, false);
+                    } else {
+                        skip_content(next);
+                        skip_content(tag);
+                        simple = false;
+                    }
+                }
+                leave(mark);
+                items.push_back(std::move(item));
+                languages.push_back(std::move(language));
+            }
+        }
+
+        value_t value;
+        if (alternative && !languages.empty() && languages.front()) {
+            // Language alternative; Exiv2 only hands out the x-default entry
+            if (!simple) throw unsupported_t{};
+            value.kind = value_t::kind_t::lang_alt;
+            std::optional<std::string> x_default;
+            for (std::size_t i = 0; i < items.size(); ++i) {
+                if (!languages[i]) throw unsupported_t{};
+                if (*languages[i] == "x-default") x_default = items[i];
+            }
+            if (!x_default) throw unsupported_t{};
+            value.items.push_back(std::move(*x_default));
+            return value;
+        }
+        for (auto&& language : languages)
+            if (language) simple = false;
+        if (!simple) return text_value({});
+        value.kind = alternative ? value_t::kind_t::alt : value_t::kind_t::list;
+        value.items = std::move(items);
+        return value;
+    }
+
+    std::string_view const x_;
+    std::size_t p_ = 0;
+    std::vector<std::pair<std::string_view, std::string_view>> namespaces_;
+    std::map<std::string, value_t> values_;
+};
+
+// The XMP toolkit isn't thread-safe on its own; Exiv2 calls this around every use of it
+void lock_xmp_toolkit(void*, bool lock) {
+    static std::mutex mutex;
+    if (lock)
+        mutex.lock();
+    else
+        mutex.unlock();
+}
+
+}  // namespace
+
+std::optional<std::map<std::string, value_t>> parse_xmp_fast(std::string_view packet) {
+    try {
+        return parser_t{packet}.parse();
+    } catch (unsupported_t const&) {
+        return std::nullopt;
+    } catch (std::out_of_range const&) {
+        return std::nullopt;
+    }
+}
+
+void initialize_xmp_toolkit() {
+    static std::once_flag once;
+    std::call_once(once, [] { Exiv2::XmpParser::initialize(&lock_xmp_toolkit); });
+}
+
+std::map<std::string, value_t> parse_xmp_exiv2(std::string const& packet) {
+    Exiv2::XmpData data;
+    if (Exiv2::XmpParser::decode(data, packet) != 0) throw Exiv2::Error(Exiv2::kerErrorMessage, "Failed to decode XMP");
+    std::map<std::string, value_t> values;
+    for (auto&& datum : data) {
+        auto key = datum.key();
+        if (!is_recorded_key(key)) continue;
+        if (auto value = value_t::from(datum.value())) values.emplace(std::move(key), std::move(*value));
+    }
+    return values;
+}
+
+std::map<std::string, value_t> parse_xmp(std::string const& packet) {
+    if (auto values = parse_xmp_fast(packet)) {
+        ++fast_count;
+        return std::move(*values);
+    }
+    ++fallback_count;
+    return parse_xmp_exiv2(packet);
+}
+
+xmp_totals_t xmp_totals() { return {fast_count, fallback_count}; }
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "value.h"
+
+// Parses the RDF/XML forms Lightroom and Camera Raw write into sidecars: simple properties as rdf:Description
+// attributes or elements, and rdf:Bag/Seq/Alt arrays of simple items. Only the recorded namespaces (crs, dc, lr, tiff,
+// xmp) are kept, with the same keys and value types Exiv2 would produce. Returns nullopt for anything outside that
+// subset (DTDs, CDATA, qualifiers, rdf:resource, ...) so the caller can fall back to Exiv2.
+std::optional<std::map<std::string, value_t>> parse_xmp_fast(std::string_view packet);
+
+// Lets Exiv2's XMP toolkit be used from several threads. Call before parsing any XMP; later calls do nothing.
+void initialize_xmp_toolkit();
+
+// Parses the packet with Exiv2's XMP toolkit, keeping only the recorded keys
+std::map<std::string, value_t> parse_xmp_exiv2(std::string const& packet);
+
+// parse_xmp_fast, falling back to parse_xmp_exiv2
+std::map<std::string, value_t> parse_xmp(std::string const& packet);
+
+struct xmp_totals_t {
+    std::uint64_t fast = 0;
+    std::uint64_t fallback = 0;
+
+    friend std::ostream& operator<<(std::ostream& s, xmp_totals_t const& x) {
+        return s << x.fast << " by the fast path, " << x.fallback << " by Exiv2";
+    }
+};
+
+// Counts of packets parse_xmp handled on each path so far, across all threads
+xmp_totals_t xmp_totals();